@@ -0,0 +1,494 @@
+// Throughput of each pipeline stage with a synthetic, reproducible workload
+// The stages call the code of the DAQ itself, only CAEN_FELib_ReadData is
+// replaced by a copy from pre-generated traces:
+//   ReadoutCopy   ReadData output copied into the batch of each board
+//                 (TDigitizer::PushEvent)
+//   Aggregation   board batches merged and handed over
+//                 (TDataTaking::AggregateEvents, GetData)
+//   Conversion    TEventData to TSmallEventData (TDataRecorder::ConvertData)
+//   Sort          per batch and before writing (TDataRecorder::SortData)
+//   TreeFill      TTree::Fill and compression (TDataRecorder::FillFile)
+//   MonitorFill   histograms and traces (TDataMonitor::FillBatch)
+// Results are written as JSON to compare between releases.
+
+#include <TROOT.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TDataMonitor.hpp"
+#include "TDataRecorder.hpp"
+#include "TDataTaking.hpp"
+#include "TDigitizer.hpp"
+#include "TEventData.hpp"
+
+struct TBenchConf {
+  uint32_t nHits = 200000;
+  uint32_t batchSize = 10000;  // hits of all modules per aggregated batch
+  double rate = 1.e6;          // Hz, all modules
+  uint32_t nModules = 8;
+  uint32_t nChannels = 64;  // per module
+  uint32_t waveformLength = 256;
+  double pileUpFraction = 0.05;
+  uint32_t seed = 1;
+  uint32_t nRepeats = 3;
+  bool compressWaveform = false;
+  std::string outputName = "digicon_bench.json";
+  std::string filePrefix = "digicon_bench";
+};
+
+enum class BenchStage {
+  ReadoutCopy,
+  Aggregation,
+  Conversion,
+  Sort,
+  TreeFill,
+  MonitorFill,
+  NStages
+};
+constexpr auto kNBenchStages = static_cast<size_t>(BenchStage::NStages);
+constexpr const char *kBenchStageNames[kNBenchStages] = {
+    "ReadoutCopy", "Aggregation", "Conversion", "Sort", "TreeFill",
+    "MonitorFill"};
+
+class TPipelineBench
+{
+ public:
+  explicit TPipelineBench(const TBenchConf &conf);
+
+  void Run();
+  nlohmann::json GetResults() const;
+  void Print() const;
+
+ private:
+  TBenchConf fConf;
+  static constexpr uint32_t kDeltaT = 2;  // ns per sample
+
+  // ReadData output of one hit, one byte per digital sample as FELib
+  struct RawTrace {
+    std::vector<int16_t> analogProbe1;
+    std::vector<int16_t> analogProbe2;
+    std::vector<uint8_t> digitalProbe1;
+    std::vector<uint8_t> digitalProbe2;
+  };
+  static constexpr uint32_t kNTraces = 256;
+  std::vector<RawTrace> fTraces;  // first half single, second half pile-up
+
+  struct Hit {
+    uint8_t module;
+    uint8_t channel;
+    uint16_t energy;
+    int16_t energyShort;
+    uint32_t trace;
+    uint64_t timeStamp;  // ns
+  };
+  // In readout order: batch by batch, within a batch module by module
+  std::vector<Hit> fHits;
+  std::vector<uint32_t> fBatchFirst;  // first hit of each batch
+
+  std::array<std::vector<double>, kNBenchStages> fSeconds;  // per repeat
+  std::vector<uint64_t> fFileBytes;
+
+  void MakeTraces();
+  void MakeHits();
+  void RunOnce(uint32_t repeat);
+  void AddTime(BenchStage stage, double seconds, uint32_t repeat)
+  {
+    fSeconds[static_cast<size_t>(stage)][repeat] += seconds;
+  }
+};
+
+namespace
+{
+double Elapsed(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+double Median(std::vector<double> values)
+{
+  if (values.empty()) return 0.;
+  std::sort(values.begin(), values.end());
+  const auto n = values.size();
+  return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+}  // namespace
+
+TPipelineBench::TPipelineBench(const TBenchConf &conf) : fConf(conf)
+{
+  for (auto &seconds : fSeconds) seconds.assign(fConf.nRepeats, 0.);
+  MakeTraces();
+  MakeHits();
+}
+
+void TPipelineBench::MakeTraces()
+{
+  std::mt19937 gen(fConf.seed);
+  std::normal_distribution<float> noise(0.f, 3.f);
+  std::uniform_real_distribution<float> amplitude(500.f, 8000.f);
+  const auto length = fConf.waveformLength;
+  const auto trigger = length / 4;
+  std::uniform_int_distribution<uint32_t> secondPulse(trigger + 8,
+                                                      std::max(trigger + 8,
+                                                               length));
+  constexpr float baseline = 2000.f;
+  constexpr float riseTime = 4.f;   // samples
+  constexpr float decayTime = 40.f;  // samples
+  constexpr uint32_t gate = 60;     // samples
+
+  auto addPulse = [length](std::vector<float> &trace, uint32_t start,
+                           float height) {
+    for (auto i = start; i < length; i++) {
+      const float t = i - start;
+      trace[i] -= height * (1.f - std::exp(-t / riseTime)) *
+                  std::exp(-t / decayTime);
+    }
+  };
+
+  fTraces.resize(kNTraces);
+  for (auto iTrace = 0U; iTrace < kNTraces; iTrace++) {
+    std::vector<float> trace(length, baseline);
+    addPulse(trace, trigger, amplitude(gen));
+    const auto isPileUp = iTrace >= kNTraces / 2;
+    if (isPileUp) addPulse(trace, secondPulse(gen), amplitude(gen));
+
+    auto &raw = fTraces[iTrace];
+    raw.analogProbe1.resize(length);
+    raw.analogProbe2.resize(length);
+    raw.digitalProbe1.assign(length, 0);
+    raw.digitalProbe2.assign(length, 0);
+    for (auto i = 0U; i < length; i++) {
+      auto sample = std::clamp(trace[i] + noise(gen), 0.f, 16383.f);
+      raw.analogProbe1[i] = static_cast<int16_t>(sample);
+      // Baseline subtracted as the CFD probe of the firmware
+      raw.analogProbe2[i] = static_cast<int16_t>(baseline - sample);
+      raw.digitalProbe1[i] = i >= trigger && i < trigger + gate;
+      raw.digitalProbe2[i] = i >= trigger && i < trigger + 4;
+    }
+  }
+}
+
+void TPipelineBench::MakeHits()
+{
+  std::mt19937_64 gen(fConf.seed);
+  const auto moduleRate = fConf.rate / fConf.nModules;
+  std::exponential_distribution<double> gap(moduleRate * 1.e-9);
+  std::uniform_real_distribution<double> pileUpGap(
+      0., double(fConf.waveformLength) * kDeltaT);
+  std::bernoulli_distribution isPileUp(fConf.pileUpFraction);
+  std::uniform_int_distribution<uint32_t> channel(0, fConf.nChannels - 1);
+  std::uniform_int_distribution<uint32_t> trace(0, kNTraces / 2 - 1);
+  // Continuum and one line, as a calibration source
+  std::exponential_distribution<double> continuum(1. / 3000.);
+  std::normal_distribution<double> line(6620., 60.);
+  std::bernoulli_distribution isLine(0.3);
+  std::uniform_real_distribution<double> shortFraction(0.7, 0.95);
+
+  std::vector<double> moduleTime(fConf.nModules, 0.);
+  fHits.clear();
+  fHits.reserve(fConf.nHits);
+  fBatchFirst.clear();
+  while (fHits.size() < fConf.nHits) {
+    fBatchFirst.push_back(fHits.size());
+    const auto nBatch =
+        std::min<uint32_t>(fConf.batchSize, fConf.nHits - fHits.size());
+    for (auto iMod = 0U; iMod < fConf.nModules; iMod++) {
+      // The remainder goes to the first modules
+      auto nModule = nBatch / fConf.nModules;
+      if (iMod < nBatch % fConf.nModules) nModule++;
+      for (auto i = 0U; i < nModule; i++) {
+        Hit hit;
+        const auto pileUp = isPileUp(gen);
+        moduleTime[iMod] += pileUp ? pileUpGap(gen) : gap(gen);
+        hit.timeStamp = static_cast<uint64_t>(moduleTime[iMod]);
+        hit.module = iMod;
+        hit.channel = channel(gen);
+        auto energy = isLine(gen) ? line(gen) : continuum(gen);
+        hit.energy = static_cast<uint16_t>(std::clamp(energy, 1., 30000.));
+        hit.energyShort =
+            static_cast<int16_t>(hit.energy * shortFraction(gen));
+        hit.trace = trace(gen) + (pileUp ? kNTraces / 2 : 0);
+        fHits.push_back(hit);
+      }
+    }
+  }
+}
+
+void TPipelineBench::Run()
+{
+  for (auto repeat = 0U; repeat < fConf.nRepeats; repeat++) {
+    std::cout << "Repeat " << repeat + 1 << " of " << fConf.nRepeats
+              << std::endl;
+    RunOnce(repeat);
+  }
+}
+
+void TPipelineBench::RunOnce(uint32_t repeat)
+{
+  const auto length = fConf.waveformLength;
+  std::vector<uint32_t> nChs(fConf.nModules, fConf.nChannels);
+
+  TDataTaking daq;
+  TDataRecorder recorder;
+  recorder.SetWaveformCompression(fConf.compressWaveform);
+  TDataMonitor monitor(0);  // no HTTP server, it may already be running
+  monitor.SetFirmware(std::vector<std::string>(fConf.nModules, "DPP-PSD"));
+  monitor.LoadChannelConf(nChs);
+  monitor.SetDeltaT(std::vector<uint32_t>(fConf.nModules, kDeltaT));
+
+  // Buffers of the readout threads, one per module
+  std::vector<TEventData> eventData;
+  for (auto iMod = 0U; iMod < fConf.nModules; iMod++) {
+    auto &event = eventData.emplace_back(length);
+    event.analogProbe1Type = event.analogProbe2Type = 0;
+    event.digitalProbe1Type = event.digitalProbe2Type = 0;
+  }
+  std::vector<std::vector<uint8_t>> digitalProbe1(
+      fConf.nModules, std::vector<uint8_t>(length));
+  std::vector<std::vector<uint8_t>> digitalProbe2(
+      fConf.nModules, std::vector<uint8_t>(length));
+
+  std::vector<TSmallEventData *> fileData;
+  fileData.reserve(fConf.nHits);
+  for (auto iBatch = 0U; iBatch < fBatchFirst.size(); iBatch++) {
+    const auto first = fBatchFirst[iBatch];
+    const auto last = iBatch + 1 < fBatchFirst.size()
+                          ? fBatchFirst[iBatch + 1]
+                          : uint32_t(fHits.size());
+
+    // Each module fills its own batch, as its readout thread
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DAQData_t> moduleBatch(fConf.nModules);
+    for (auto iHit = first; iHit < last; iHit++) {
+      const auto &hit = fHits[iHit];
+      const auto &raw = fTraces[hit.trace];
+      auto &event = eventData[hit.module];
+      event.module = hit.module;
+      event.channel = hit.channel;
+      event.timeStamp = hit.timeStamp / kDeltaT;
+      event.timeStampNs = hit.timeStamp;
+      event.energy = hit.energy;
+      event.energyShort = hit.energyShort;
+      event.flags = 0;
+      event.waveformSize = length;
+      event.eventSize = 0;
+      if (length == 0) {
+        TDigitizer::PushEvent(event, digitalProbe1[hit.module],
+                              digitalProbe2[hit.module],
+                              moduleBatch[hit.module]);
+        continue;
+      }
+      std::memcpy(event.analogProbe1.data(), raw.analogProbe1.data(),
+                  length * sizeof(int16_t));
+      std::memcpy(event.analogProbe2.data(), raw.analogProbe2.data(),
+                  length * sizeof(int16_t));
+      std::memcpy(digitalProbe1[hit.module].data(), raw.digitalProbe1.data(),
+                  length);
+      std::memcpy(digitalProbe2[hit.module].data(), raw.digitalProbe2.data(),
+                  length);
+      TDigitizer::PushEvent(event, digitalProbe1[hit.module],
+                            digitalProbe2[hit.module],
+                            moduleBatch[hit.module]);
+    }
+    AddTime(BenchStage::ReadoutCopy, Elapsed(start), repeat);
+
+    start = std::chrono::steady_clock::now();
+    DAQData_t localEventsVec;
+    for (auto &batch : moduleBatch) {
+      localEventsVec.insert(localEventsVec.end(),
+                            std::make_move_iterator(batch.begin()),
+                            std::make_move_iterator(batch.end()));
+    }
+    daq.AggregateEvents(localEventsVec);
+    auto data = daq.GetData();
+    AddTime(BenchStage::Aggregation, Elapsed(start), repeat);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<TSmallEventData *> batchData;
+    recorder.ConvertData(*data, batchData);
+    AddTime(BenchStage::Conversion, Elapsed(start), repeat);
+
+    start = std::chrono::steady_clock::now();
+    TDataRecorder::SortData(batchData);
+    AddTime(BenchStage::Sort, Elapsed(start), repeat);
+    fileData.insert(fileData.end(), batchData.begin(), batchData.end());
+
+    // On this thread, SetData would start a fill task of the scheduler
+    start = std::chrono::steady_clock::now();
+    monitor.FillBatch(std::move(data));
+    AddTime(BenchStage::MonitorFill, Elapsed(start), repeat);
+  }
+
+  // As a rollover of the recorder, sorted again over all batches
+  auto start = std::chrono::steady_clock::now();
+  TDataRecorder::SortData(fileData);
+  AddTime(BenchStage::Sort, Elapsed(start), repeat);
+
+  const auto fileName = fConf.filePrefix + ".root";
+  start = std::chrono::steady_clock::now();
+  recorder.FillFile(fileName, fileData);
+  AddTime(BenchStage::TreeFill, Elapsed(start), repeat);
+
+  std::error_code ec;
+  fFileBytes.push_back(std::filesystem::file_size(fileName, ec));
+  if (ec) fFileBytes.back() = 0;
+  std::filesystem::remove(fileName, ec);
+}
+
+nlohmann::json TPipelineBench::GetResults() const
+{
+  nlohmann::json results;
+  results["workload"] = {{"Hits", fConf.nHits},
+                         {"BatchSize", fConf.batchSize},
+                         {"Rate", fConf.rate},
+                         {"Modules", fConf.nModules},
+                         {"ChannelsPerModule", fConf.nChannels},
+                         {"WaveformLength", fConf.waveformLength},
+                         {"PileUpFraction", fConf.pileUpFraction},
+                         {"Seed", fConf.seed},
+                         {"CompressWaveform", fConf.compressWaveform}};
+  results["repeats"] = fConf.nRepeats;
+  results["hardwareThreads"] = std::thread::hardware_concurrency();
+  results["compiler"] = __VERSION__;
+
+  auto stageResult = [this](const std::vector<double> &seconds) {
+    const auto median = Median(seconds);
+    const auto min = *std::min_element(seconds.begin(), seconds.end());
+    nlohmann::json result;
+    result["seconds"] = median;
+    result["minSeconds"] = min;
+    result["nsPerHit"] = median * 1.e9 / fConf.nHits;
+    result["hitsPerSecond"] = median > 0. ? fConf.nHits / median : 0.;
+    return result;
+  };
+
+  std::vector<double> total(fConf.nRepeats, 0.);
+  for (auto i = 0U; i < kNBenchStages; i++) {
+    results["stages"][kBenchStageNames[i]] = stageResult(fSeconds[i]);
+    for (auto repeat = 0U; repeat < fConf.nRepeats; repeat++) {
+      total[repeat] += fSeconds[i][repeat];
+    }
+  }
+  auto &treeFill = results["stages"]["TreeFill"];
+  treeFill["fileBytes"] = fFileBytes.front();
+  treeFill["bytesPerHit"] = double(fFileBytes.front()) / fConf.nHits;
+  results["total"] = stageResult(total);
+  return results;
+}
+
+void TPipelineBench::Print() const
+{
+  std::cout << "Stage          ns/hit    Mhits/s" << std::endl;
+  for (auto i = 0U; i < kNBenchStages; i++) {
+    const auto median = Median(fSeconds[i]);
+    const auto nsPerHit = median * 1.e9 / fConf.nHits;
+    std::cout << std::left << std::setw(12) << kBenchStageNames[i]
+              << std::right << std::setw(10) << std::fixed
+              << std::setprecision(1) << nsPerHit << std::setw(11)
+              << std::setprecision(2)
+              << (median > 0. ? fConf.nHits / median * 1.e-6 : 0.)
+              << std::endl;
+  }
+}
+
+void PrintUsage()
+{
+  std::cout << "Usage: digicon-bench [options]\n"
+            << "  -n hits          total number of hits (200000)\n"
+            << "  -b batch         hits per aggregated batch (10000)\n"
+            << "  -r rate          hit rate of all modules in Hz (1e6)\n"
+            << "  -m modules       number of modules (8)\n"
+            << "  -c channels      channels per module (64)\n"
+            << "  -l length        waveform length in samples, 0 for none "
+               "(256)\n"
+            << "  -u fraction      pile-up fraction (0.05)\n"
+            << "  -s seed          random seed (1)\n"
+            << "  -i repeats       number of repeats, median reported (3)\n"
+            << "  -z               compress waveforms (TWaveformCodec)\n"
+            << "  -o file          JSON results (digicon_bench.json)\n"
+            << "  -f prefix        temporary ROOT file (digicon_bench)"
+            << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  ROOT::EnableThreadSafety();
+
+  TBenchConf conf;
+  try {
+    for (auto i = 1; i < argc; i++) {
+      const std::string arg = argv[i];
+      const auto hasValue = i + 1 < argc;
+      if (arg == "-z") {
+        conf.compressWaveform = true;
+      } else if (arg == "-n" && hasValue) {
+        conf.nHits = std::stoul(argv[++i]);
+      } else if (arg == "-b" && hasValue) {
+        conf.batchSize = std::stoul(argv[++i]);
+      } else if (arg == "-r" && hasValue) {
+        conf.rate = std::stod(argv[++i]);
+      } else if (arg == "-m" && hasValue) {
+        conf.nModules = std::stoul(argv[++i]);
+      } else if (arg == "-c" && hasValue) {
+        conf.nChannels = std::stoul(argv[++i]);
+      } else if (arg == "-l" && hasValue) {
+        conf.waveformLength = std::stoul(argv[++i]);
+      } else if (arg == "-u" && hasValue) {
+        conf.pileUpFraction = std::stod(argv[++i]);
+      } else if (arg == "-s" && hasValue) {
+        conf.seed = std::stoul(argv[++i]);
+      } else if (arg == "-i" && hasValue) {
+        conf.nRepeats = std::stoul(argv[++i]);
+      } else if (arg == "-o" && hasValue) {
+        conf.outputName = argv[++i];
+      } else if (arg == "-f" && hasValue) {
+        conf.filePrefix = argv[++i];
+      } else {
+        PrintUsage();
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Bad option value: " << e.what() << std::endl;
+    PrintUsage();
+    return 1;
+  }
+
+  if (conf.nHits == 0 || conf.batchSize == 0 || conf.nRepeats == 0 ||
+      conf.rate <= 0. || conf.nModules == 0 || conf.nModules > 256 ||
+      conf.nChannels == 0 || conf.nChannels > 256 ||
+      conf.pileUpFraction < 0. || conf.pileUpFraction > 1.) {
+    std::cerr << "Option out of range" << std::endl;
+    PrintUsage();
+    return 1;
+  }
+
+  TPipelineBench bench(conf);
+  bench.Run();
+  bench.Print();
+
+  std::ofstream fout(conf.outputName);
+  if (!fout) {
+    std::cerr << "Cannot write " << conf.outputName << std::endl;
+    return 1;
+  }
+  fout << bench.GetResults().dump(2) << std::endl;
+  std::cout << "Results written to " << conf.outputName << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef TChannelMap_HPP
+#define TChannelMap_HPP 1
+
+// Flat index of all channels of the crate
+// Modules are numbered by position (0 .. GetNModules() - 1) and found from
+// the module ID of a hit with a 256 entry table. The channels of the module
+// at position i are the flat indices GetOffset(i) .. GetOffset(i) + nChs - 1,
+// so per channel data is one vector of GetNChannels() for any crate size.
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class TChannelMap
+{
+ public:
+  static constexpr uint32_t kNoModule = UINT32_MAX;
+  static constexpr uint32_t kNoChannel = UINT32_MAX;
+
+  TChannelMap();
+  // Module IDs default to the positions 0, 1, ...
+  TChannelMap(const std::vector<uint32_t> &nChs,
+              const std::vector<uint8_t> &moduleIDs = {});
+
+  uint32_t GetNModules() const { return fNChs.size(); }
+  uint32_t GetNChannels() const { return fNChannels; }
+  uint32_t GetNChannels(uint32_t iMod) const { return fNChs[iMod]; }
+  uint32_t GetOffset(uint32_t iMod) const { return fOffset[iMod]; }
+  uint8_t GetModuleID(uint32_t iMod) const { return fModuleIDs[iMod]; }
+
+  // kNoModule for an unknown module ID
+  uint32_t GetModuleIndex(uint8_t moduleID) const
+  {
+    return fModuleIndex[moduleID];
+  }
+  // kNoChannel for an unknown module ID or channel
+  uint32_t GetIndex(uint8_t moduleID, uint32_t ch) const
+  {
+    const auto iMod = fModuleIndex[moduleID];
+    if (iMod == kNoModule || ch >= fNChs[iMod]) return kNoChannel;
+    return fOffset[iMod] + ch;
+  }
+
+ private:
+  std::vector<uint32_t> fNChs;
+  std::vector<uint32_t> fOffset;
+  std::vector<uint8_t> fModuleIDs;
+  std::array<uint32_t, 256> fModuleIndex;
+  uint32_t fNChannels = 0;
+};
+
+#endif  // TChannelMap_HPP
@@ -0,0 +1,63 @@
+#ifndef TClockAligner_HPP
+#define TClockAligner_HPP 1
+
+// Per module clock offset correction and monitoring
+// Offsets (ns) from the configuration are added to timeStampNs before
+// the batch goes to the monitor and the recorder. When a common reference
+// (e.g. a pulser fanned out to one channel of every module) is given, the
+// remaining offset of each module to the first reference module is
+// estimated from the matched reference hits and followed with an
+// exponential moving average. An alarm is raised when it exceeds the
+// alarm threshold. With AutoCorrect the estimate is added to the offset.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "TProcessingStage.hpp"
+
+class TClockAligner : public TProcessingStage
+{
+ public:
+  TClockAligner();
+  ~TClockAligner();
+
+  std::string GetName() const override { return "ClockAlignment"; }
+  void LoadConf(const nlohmann::json &conf) override;
+  void Process(DAQData_t &data) override;
+
+  // Safe to call from other threads
+  double GetOffset(uint32_t module) const;
+  // Reference time of the first module minus this module, after correction
+  double GetResidual(uint32_t module) const;
+  bool IsAlarm(uint32_t module) const;
+  uint64_t GetNMatched(uint32_t module) const;
+  // {module, channel} of the reference signal, the first one is the master
+  const std::vector<std::pair<uint32_t, uint32_t>> &GetReferences() const
+  {
+    return fReferences;
+  }
+
+ private:
+  static constexpr uint32_t kNModules = 256;
+  std::array<std::atomic<double>, kNModules> fOffset;
+  std::array<std::atomic<double>, kNModules> fResidual;
+  std::array<std::atomic<bool>, kNModules> fAlarm;
+  std::array<std::atomic<uint64_t>, kNModules> fNMatched;
+
+  std::vector<std::pair<uint32_t, uint32_t>> fReferences;
+  // Pulses further apart than the window are not matched, keep it larger
+  // than the alarm threshold (e.g. half the pulser period)
+  double fMatchWindow = 10000.;    // ns
+  double fAlarmThreshold = 1000.;  // ns, the monitor coincidence window
+  double fAlpha = 0.05;
+  bool fAutoCorrect = false;
+
+  // Reference hit times of the batch, per entry of fReferences, reused
+  std::vector<std::vector<double>> fRefTimes;
+  void Estimate();
+};
+
+#endif  // TClockAligner_HPP
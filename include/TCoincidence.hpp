@@ -0,0 +1,72 @@
+#ifndef TCoincidence_HPP
+#define TCoincidence_HPP 1
+
+// Online time difference histograms between channel pairs
+// Hits of the involved channels are ordered in time, and for each hit the
+// reference hits inside +-window are searched, at most kMaxSearch hits away
+// in each direction. Hits at the end of a batch are kept for the next batch.
+// Fill tasks finish in any order, so batches are offered with the sequence
+// number they were dequeued with and processed strictly in that order by
+// ProcessPending (one consumer at a time).
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "TCompactHist.hpp"
+#include "TEventData.hpp"
+
+class TCoincidence
+{
+ public:
+  TCoincidence(double window, uint32_t nBins);
+  ~TCoincidence() {};
+
+  static uint32_t GetID(uint32_t mod, uint32_t ch) { return (mod << 8) | ch; }
+
+  // Time difference is (time of ch) - (time of refCh)
+  void AddPair(uint32_t refMod, uint32_t refCh, uint32_t mod, uint32_t ch);
+  uint32_t GetNPairs() const { return fPairs.size(); }
+  std::pair<uint32_t, uint32_t> GetPair(uint32_t i) const { return fPairs[i]; }
+  TCompactHist &GetHist(uint32_t i) { return *fHists[i]; }
+  double GetWindow() const { return fWindow; }
+
+  // Thread safe, only copies the hits of the involved channels.  Every
+  // sequence number must be offered once, also for batches without hits.
+  void Offer(uint64_t seq, const DAQData_t &data);
+  // Processes the offered batches which are next in sequence
+  void ProcessPending();
+  void Reset();
+
+ private:
+  static constexpr uint32_t kMaxSearch = 64;
+  double fWindow;  // in ns
+  TCompactAxis fAxis;
+
+  std::vector<std::pair<uint32_t, uint32_t>> fPairs;  // (ref ID, ID)
+  std::vector<std::unique_ptr<TCompactHist>> fHists;
+  // ID -> (reference ID, pair index) of pairs where the ID is not reference
+  std::unordered_map<uint32_t, std::vector<std::pair<uint32_t, uint32_t>>>
+      fPairsOfID;
+  std::vector<bool> fInvolved;
+
+  struct Hit {
+    double time;
+    uint32_t id;
+    bool fromTail;
+  };
+  std::map<uint64_t, std::vector<Hit>> fPending;
+  uint64_t fNextSeq = 0;
+  std::mutex fPendingMutex;
+
+  void ProcessHits(const std::vector<Hit> &hits);
+  std::vector<Hit> fHits;
+  std::vector<Hit> fTail;
+  std::mutex fMutex;  // Held by the consumer
+};
+
+#endif  // TCoincidence_HPP
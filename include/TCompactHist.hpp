@@ -0,0 +1,122 @@
+#ifndef TCompactHist_HPP
+#define TCompactHist_HPP 1
+
+// Lock free histogram storage for the monitor
+// Fill tasks only increment atomic counters, ROOTThread copies the
+// contents into the ROOT histogram registered in THttpServer.
+// Cell numbering follows ROOT global bins (0: underflow, nBins + 1: overflow,
+// 2D: binX + (nBinsX + 2) * binY), so copying is 1 to 1.
+
+#include <TH1.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class TCompactAxis
+{
+ public:
+  TCompactAxis(uint32_t nBins, double min, double max);
+  ~TCompactAxis() {};
+
+  uint32_t GetNBins() const { return fNBins; }
+  double GetMin() const { return fMin; }
+  double GetMax() const { return fMax; }
+
+  uint32_t FindBin(float x) const;
+  // Batched version, vectorised over the input array
+  void FindBins(const float *x, uint32_t *bins, uint32_t n) const;
+
+ private:
+  uint32_t fNBins;
+  double fMin;
+  double fMax;
+  float fScale;
+};
+
+class TCompactHist
+{
+ public:
+  explicit TCompactHist(const TCompactAxis &xAxis);
+  TCompactHist(const TCompactAxis &xAxis, const TCompactAxis &yAxis);
+  ~TCompactHist() {};
+
+  const TCompactAxis &GetXaxis() const { return fXaxis; }
+  const TCompactAxis &GetYaxis() const { return fYaxis; }
+  uint32_t GetNCells() const { return fNCells; }
+
+  // Global cell from the bins of each axis, vectorised over the batch
+  static void GetCells(const TCompactAxis &xAxis, const uint32_t *binsX,
+                       const uint32_t *binsY, uint32_t *cells, uint32_t n);
+
+  void AddCell(uint32_t cell)
+  {
+    fCounts[cell].fetch_add(1, std::memory_order_relaxed);
+    fEntries.fetch_add(1, std::memory_order_relaxed);
+  }
+  void SubtractCell(uint32_t cell, uint32_t n)
+  {
+    fCounts[cell].fetch_sub(n, std::memory_order_relaxed);
+    fEntries.fetch_sub(n, std::memory_order_relaxed);
+    fSubtractions.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Returns the content and sets the cell to 0
+  uint32_t TakeCell(uint32_t cell)
+  {
+    auto n = fCounts[cell].exchange(0, std::memory_order_relaxed);
+    fEntries.fetch_sub(n, std::memory_order_relaxed);
+    return n;
+  }
+  uint32_t GetCellContent(uint32_t cell) const
+  {
+    return fCounts[cell].load(std::memory_order_relaxed);
+  }
+  uint64_t GetEntries() const
+  {
+    return fEntries.load(std::memory_order_relaxed);
+  }
+
+  // Copy to the ROOT histogram, skipped when nothing changed since last copy
+  void CopyTo(TH1 *hist);
+  void Reset();
+
+ private:
+  TCompactAxis fXaxis;
+  TCompactAxis fYaxis;
+  uint32_t fNCells;
+  std::unique_ptr<std::atomic<uint32_t>[]> fCounts;
+  std::atomic<uint64_t> fEntries;
+  std::atomic<uint64_t> fSubtractions;
+  uint64_t fCopiedEntries;
+  uint64_t fCopiedSubtractions;
+};
+
+// Sliding time window spectrum
+// Ring of sub-histograms (slices) and the running sum of the window.
+// Hits are added to the newest slice and to the sum. Rotate() expires the
+// oldest slice by subtracting it from the sum, the window is never re-summed.
+// The sum covers between nSlices - 1 and nSlices slice lengths.
+class TRollingHist
+{
+ public:
+  TRollingHist(const TCompactAxis &axis, uint32_t nSlices);
+  ~TRollingHist() {};
+
+  void AddCell(uint32_t cell)
+  {
+    fSlices[fCurrent.load(std::memory_order_relaxed)]->AddCell(cell);
+    fWindow.AddCell(cell);
+  }
+  void Rotate();
+  void Reset();
+
+  TCompactHist &GetWindow() { return fWindow; }
+
+ private:
+  std::vector<std::unique_ptr<TCompactHist>> fSlices;
+  std::atomic<uint32_t> fCurrent;
+  TCompactHist fWindow;
+};
+
+#endif  // TCompactHist_HPP
@@ -6,51 +6,174 @@
 #include <TCanvas.h>
 #include <TGraph.h>
 #include <TH1.h>
+#include <TH2.h>
 #include <THttpServer.h>
 
+#include <chrono>
 #include <deque>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "TChannelMap.hpp"
+#include "TClockAligner.hpp"
+#include "TCoincidence.hpp"
+#include "TCompactHist.hpp"
+#include "TEnergyCalibrator.hpp"
 #include "TEventData.hpp"
+#include "TNoiseSpectrum.hpp"
+#include "TTaskScheduler.hpp"
 
 class TDataMonitor
 {
  public:
-  TDataMonitor();
+  // Port of the THttpServer, 0 for none (e.g. benchmarks)
+  explicit TDataMonitor(int port = 8080);
   ~TDataMonitor();
 
-  void LoadChannelConf(const std::vector<uint32_t> &nChs = {64, 64, 64, 64, 64,
-                                                            64, 64, 64});
+  // Optional settings (rolling windows, coincidence), call before
+  // LoadChannelConf
+  void LoadMonitorConf(const std::string &fileName);
+
+  // Number of channels of each module, module IDs default to the positions
+  void LoadChannelConf(const std::vector<uint32_t> &nChs,
+                       const std::vector<uint8_t> &moduleIDs = {});
+  // By module position, as the firmware
   void SetDeltaT(const std::vector<uint32_t> &deltaT) { fDeltaT = deltaT; }
+  // PSD histograms are made for "DPP-PSD" modules, call before LoadChannelConf
+  void SetFirmware(const std::vector<std::string> &fw) { fFirmware = fw; }
+  // Pre-trigger samples by module position, 0 if unknown. The noise spectra
+  // only use the pre-trigger, call before LoadChannelConf
+  void SetPreTrigger(const std::vector<uint32_t> &preTrigger)
+  {
+    fPreTrigger = preTrigger;
+  }
+  // Lengths of the sliding window spectra in s, call before LoadChannelConf
+  void SetRollingWindows(const std::vector<uint32_t> &windows)
+  {
+    fRollingWindows = windows;
+  }
+  // Relative gain of the calibration reference lines, call before
+  // LoadChannelConf
+  void SetCalibrator(std::shared_ptr<TEnergyCalibrator> calibrator)
+  {
+    fCalibrator = calibrator;
+  }
+  // Clock offsets and alignment alarms, call before LoadChannelConf
+  void SetClockAligner(std::shared_ptr<TClockAligner> aligner)
+  {
+    fClockAligner = aligner;
+  }
 
   void StartMonitor();
   void StopMonitor();
 
   void SetData(std::unique_ptr<DAQData_t> data);
+  // Fills one batch on the calling thread, without the scheduler and
+  // StartMonitor (e.g. benchmarks)
+  void FillBatch(std::unique_ptr<DAQData_t> data);
 
   void ClearHist();
 
  private:
   std::unique_ptr<THttpServer> fServer;
-  std::vector<std::vector<std::unique_ptr<TGraph>>> fGraphAP1;
-  std::vector<std::vector<std::unique_ptr<TGraph>>> fGraphAP2;
-  std::vector<std::vector<std::unique_ptr<TGraph>>> fGraphDP1;
-  std::vector<std::vector<std::unique_ptr<TGraph>>> fGraphDP2;
-  std::vector<std::vector<std::unique_ptr<TH1D>>> fHist;
-  std::vector<std::vector<std::unique_ptr<TCanvas>>> fCanvas;
-  std::vector<uint32_t> fModAndCh;
+
+  // Per channel objects are indexed by the flat index of fChannelMap,
+  // per module objects by the module position
+  TChannelMap fChannelMap;
+
+  std::vector<std::unique_ptr<TGraph>> fGraphAP1;
+  std::vector<std::unique_ptr<TGraph>> fGraphAP2;
+  std::vector<std::unique_ptr<TGraph>> fGraphDP1;
+  std::vector<std::unique_ptr<TGraph>> fGraphDP2;
+  std::unique_ptr<std::mutex[]> fGraphMutex;  // all four graphs of a channel
+  std::vector<std::unique_ptr<TH1D>> fHist;
+  std::vector<std::unique_ptr<TCompactHist>> fHistData;
+  TCompactAxis fEnergyAxis{30000, 0., 30000.};
+
+  // ChargeLong vs ChargeShort and PSD ratio, nullptr for other than DPP-PSD
+  std::vector<std::unique_ptr<TH2I>> fPSDHist;
+  std::vector<std::unique_ptr<TCompactHist>> fPSDHistData;
+  std::vector<std::unique_ptr<TH1D>> fPSDRatioHist;
+  std::vector<std::unique_ptr<TCompactHist>> fPSDRatioHistData;
+  TCompactAxis fChargeLongAxis{256, 0., 32768.};
+  TCompactAxis fChargeShortAxis{256, 0., 32768.};
+  TCompactAxis fPSDRatioAxis{1000, 0., 1.};
+  std::vector<std::string> fFirmware;
+  bool fUsePSD = false;
+  void InitPSDHist();
+
+  // Counts of checked traces and of each QA flag, [module], x: channel
+  std::vector<std::unique_ptr<TH2I>> fQAHist;
+  std::vector<std::unique_ptr<TCompactHist>> fQAHistData;
+  void InitQAHist();
+
+  // Hits and rate of each particle class (TPSDClassifier), x: channel
+  std::vector<std::unique_ptr<TH2I>> fClassHist;
+  std::vector<std::unique_ptr<TH2D>> fClassRateHist;
+  std::vector<std::unique_ptr<TCompactHist>> fClassHistData;
+  std::vector<std::vector<uint32_t>> fClassLastCounts;
+  std::chrono::steady_clock::time_point fLastClassUpdate;
+  void InitClassHist();
+  void UpdateClassRate();
+
+  // Gain drift from TEnergyCalibrator, [module], x: channel
+  std::shared_ptr<TEnergyCalibrator> fCalibrator;
+  std::vector<std::unique_ptr<TH1D>> fGainHist;
+  void InitGainHist();
+  void UpdateGainHist();
+
+  // Clock offsets from TClockAligner, x: module
+  std::shared_ptr<TClockAligner> fClockAligner;
+  std::unique_ptr<TH1D> fClockOffsetHist;
+  std::unique_ptr<TH1D> fClockResidualHist;
+  std::unique_ptr<TH1D> fClockAlarmHist;
+  void InitClockHist();
+  void UpdateClockHist();
+
+  // ReadData statistics from TPipelineStats, x: module
+  std::unique_ptr<TH1D> fReadoutEventsHist;   // hits per ReadData call
+  std::unique_ptr<TH1D> fReadoutTimeoutHist;  // fraction of timeouts
+  std::unique_ptr<TH1D> fReadoutBatchHist;    // hits per flushed batch
+  void InitReadoutHist();
+  void UpdateReadoutHist();
+  void SetModuleLabels(TH1 *hist) const;  // module IDs on the x axis
+
+  // Baseline power spectra per channel, 0 samples to disable
+  uint32_t fNoiseSamples = 64;
+  std::vector<uint32_t> fPreTrigger;
+  uint32_t fNoiseDecimation = 100;  // every Nth trace of a channel
+  std::unique_ptr<TNoiseSpectrum> fNoise;
+  std::vector<std::unique_ptr<TH1D>> fNoiseHist;
+  void InitNoiseHist();
+  void SetNoiseAxis();  // needs fDeltaT
+  void UpdateNoiseHist();
+
+  // Sliding window spectra, [window][channel]
+  std::vector<uint32_t> fRollingWindows = {10, 300};  // in s
+  static constexpr uint32_t fRollingSlices = 20;
+  TCompactAxis fRollingAxis{1000, 0., 30000.};
+  std::vector<std::vector<std::unique_ptr<TH1D>>> fRollingHist;
+  std::vector<std::vector<std::unique_ptr<TRollingHist>>> fRollingHistData;
+  std::vector<std::chrono::steady_clock::time_point> fLastRotation;
+  void InitRollingHist();
+  void RotateRollingHist();
+
+  // Time difference between channel pairs
+  double fCoincidenceWindow = 1000.;  // in ns
+  uint32_t fCoincidenceBins = 2000;
+  // Module IDs, not positions
+  std::vector<std::vector<uint32_t>> fTimePairs;  // {refMod, refCh, mod, ch}
+  std::vector<std::vector<uint32_t>> fTimeReferences;  // {refMod, refCh}
+  std::unique_ptr<TCoincidence> fCoincidence;
+  std::vector<std::unique_ptr<TH1D>> fTimeDiffHist;
+  void InitTimeDiffHist();
+  std::vector<std::unique_ptr<TCanvas>> fCanvas;
   std::vector<uint32_t> fDeltaT;
-  // Mutex is not big size. It is OK to use more than really needed
-  static constexpr uint32_t fNChs = 64;
-  static constexpr uint32_t fNMods = 16;
-  std::mutex fAP1Mutex[fNMods][fNChs];
-  std::mutex fAP2Mutex[fNMods][fNChs];
-  std::mutex fDP1Mutex[fNMods][fNChs];
-  std::mutex fDP2Mutex[fNMods][fNChs];
   void InitHist();
+  void UpdateHist();
   void InitGraph();
   void InitCanvas();
   void RegisterHistCanvas();
@@ -58,11 +181,22 @@ class TDataMonitor
   bool fMonitorRunning;
   std::deque<std::unique_ptr<DAQData_t>> fDataQueue;
   std::mutex fDataQueueMutex;
-  std::mutex fThreadMutex;
-  std::vector<std::thread> fThreadPool;
-  void FillingThread();
+  // Filling runs as TTaskScheduler tasks, one per batch
+  TTaskScheduler::Queue *fFillQueue;
+  void FillBatch();  // the next batch of fDataQueue
+  // whileRunning: traces are no longer drawn once StopMonitor is called
+  void FillData(const DAQData_t &data, uint64_t seq, bool whileRunning);
+  // Coincidences need the batches in order, numbered when dequeued
+  TTaskScheduler::Queue *fCoincidenceQueue;
+  uint64_t fNextBatch = 0;  // guarded by fDataQueueMutex
 
+  std::thread fROOTThread;
   void ROOTThread();
+
+  // Latency of each pipeline stage, copied from TPipelineStats
+  std::vector<std::unique_ptr<TH1D>> fLatencyHist;
+  void InitLatencyHist();
+  void UpdateLatencyHist();
 };
 
 #endif  // TDataMonitor_HPP
\ No newline at end of file
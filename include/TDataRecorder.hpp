@@ -6,10 +6,20 @@
 #include <memory>
 #include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
 
 #include "TEventData.hpp"
+#include "TTaskScheduler.hpp"
+
+class TTree;
+
+// Probes written to the file, combined with |
+enum RecordProbe : uint8_t {
+  kRecordAnalogProbe1 = 1 << 0,  // "Signal"
+  kRecordAnalogProbe2 = 1 << 1,  // "AnalogProbe2"
+  kRecordDigitalProbe1 = 1 << 2,  // "DigitalProbe1", bit packed
+  kRecordDigitalProbe2 = 1 << 3   // "DigitalProbe2", bit packed
+};
 
 class TDataRecorder
 {
@@ -24,6 +34,20 @@ class TDataRecorder
   void SetSizeLimit(const uint32_t &maxSize);
   void SetTimeLimit(const uint32_t &minutes);
   void SetFileName(const std::string &fileName);
+  // Store traces as TWaveformCodec byte arrays ("SignalCodec" branch)
+  void SetWaveformCompression(bool compress) { fCompressWaveform = compress; }
+  void SetRecordProbes(uint8_t probes) { fRecordProbes = probes; }
+  // One tree per particle class ("data_Gamma", ...) instead of "data"
+  void SetSplitClasses(bool split) { fSplitClasses = split; }
+
+  // Stages of ConvertBatch and WriteFile, also run directly by benchmarks
+  // Appends the converted hits, returns their size in bytes
+  uint32_t ConvertData(const DAQData_t &data,
+                       std::vector<TSmallEventData *> &dataVec) const;
+  static void SortData(std::vector<TSmallEventData *> &dataVec);
+  // Fills the trees of a new file, the hits are deleted
+  void FillFile(const std::string &fileName,
+                std::vector<TSmallEventData *> &dataVec) const;
 
  private:
   bool fRecording;
@@ -33,8 +57,12 @@ class TDataRecorder
   std::chrono::minutes fMaxTime{30};
   std::chrono::system_clock::time_point fLastWrite;
   std::string fFileName = "tmp";
-  uint32_t fFileVersion;
+  uint32_t fFileVersion = 0;  // reset when the file name changes
   std::mutex fFileMutex;
+  std::string NextFileName();  // with fFileMutex held
+  bool fCompressWaveform = false;
+  uint8_t fRecordProbes = kRecordAnalogProbe1;
+  bool fSplitClasses = false;
 
   std::deque<std::unique_ptr<DAQData_t>> fRawDataQue;
   std::mutex fRawDataQueMutex;
@@ -42,10 +70,19 @@ class TDataRecorder
   std::vector<TSmallEventData *> fDataVec;
   std::mutex fDataVecMutex;
 
-  std::vector<std::thread> fThreadPool;
-  void WritingThread();
-  void ConvertingThread();
-  void WriteData(std::vector<TSmallEventData *> &data);
+  // Tasks of TTaskScheduler
+  TTaskScheduler::Queue *fConvertQueue;
+  TTaskScheduler::Queue *fWriteQueue;
+  void ConvertBatch();
+  void CheckRollover();  // Submits WriteFile at the size or time limit
+  void WriteFile(std::vector<TSmallEventData *> &data, bool timeCondition,
+                 bool sizeCondition);
+  void ConvertEvent(const TEventData &event, TSmallEventData &smallEvent) const;
+  void CreateBranches(TTree *tree, TSmallEventData &event) const;
+  std::vector<TTree *> CreateTrees(TSmallEventData &event) const;
+  TTree *SelectTree(const std::vector<TTree *> &trees,
+                    const TSmallEventData &event) const;
+  static uint32_t GetTraceSize(const TSmallEventData &event);
 
   void PostProcess();
 };
@@ -2,6 +2,9 @@
 #define TDataTaking_HPP 1
 // Handle digitizers and readout data
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -10,6 +13,7 @@
 
 #include "TDigitizer.hpp"
 #include "TEventData.hpp"
+#include "TProcessingStage.hpp"
 
 class TDataTaking
 {
@@ -26,22 +30,57 @@ class TDataTaking
 
   void ConfigDigitizers();
 
+  // Re-read the configuration files while running.  Only boards whose file
+  // changed are disarmed, reconfigured and re-armed, the others keep taking
+  // data.  Time synchronised boards are not re-armed, reload again while
+  // stopped to apply their files.  Returns the number of reconfigured
+  // boards.
+  uint32_t ReloadDigitizers();
+  // Reconfigure one board by module ID, false if no such module
+  bool ReconfigureDigitizer(uint8_t moduleID);
+
   void StartAcquisition();
   void StopAcquisition();
 
-  std::unique_ptr<DAQData_t> GetData();
+  // Waits up to timeout for a batch, nullptr if there is none
+  std::unique_ptr<DAQData_t> GetData(
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+  // Wakes up a waiting GetData, e.g. for a run control command
+  void Interrupt();
+
+  // Applied in order to every batch before GetData
+  void SetProcessingStages(
+      const std::vector<std::shared_ptr<TProcessingStage>> &stages)
+  {
+    fProcessingStages = stages;
+  }
 
   std::vector<uint32_t> GetNumberOfCh();
   std::vector<uint32_t> GetDeltaT();
+  std::vector<uint32_t> GetPreTrigger();
+  std::vector<std::string> GetFirmware();
+  std::vector<uint8_t> GetModuleID();
+
+  // Processing stages, then appended to the batch for GetData.  Called by
+  // the fetching thread, or directly without digitizers (e.g. benchmarks)
+  void AggregateEvents(DAQData_t &events);
 
  private:
   std::vector<std::string> fConfigFileList;
   std::vector<std::unique_ptr<TDigitizer>> fDigitizers;
   void LoadConfigFiles();
+  void ConfigDigitizer(TDigitizer &dig);  // On the owner thread
+
+  // Run func on every owner thread in parallel and wait for all, the first
+  // exception is rethrown
+  void RunOnDigitizers(const std::function<void(TDigitizer &)> &func);
 
   void ResetEventsVec();
   std::unique_ptr<DAQData_t> fEventsVec;
   std::mutex fEventsVecMutex;
+  std::condition_variable fEventsVecCV;
+  bool fInterrupted = false;
+  std::size_t fLastBatchSize = 0;
 
   bool fRunning = false;
   uint32_t fSleepTime = 1;  // in ms
@@ -49,6 +88,8 @@ class TDataTaking
   void FetchingData();
 
   bool fForceTrace = false;
+
+  std::vector<std::shared_ptr<TProcessingStage>> fProcessingStages;
 };
 
 #endif  // TDataTaking_HPP
\ No newline at end of file
@@ -3,11 +3,16 @@
 
 #include <CAEN_FELib.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "TEventData.hpp"
@@ -18,12 +23,14 @@ class TDigitizer
   TDigitizer();
   virtual ~TDigitizer();
 
-  void LoadParameters(const std::string &filename);
+  // Returns true if the parameters differ from the loaded ones
+  bool LoadParameters(const std::string &filename);
   void OpenDigitizer();
   void CloseDigitizer();
   void ConfigDigitizer();
 
-  void StartAcquisition();
+  // clearEvents = false keeps hits not yet taken by GetEvents
+  void StartAcquisition(bool clearEvents = true);
   void SendStartSignal();
   void StopAcquisition();
 
@@ -33,24 +40,89 @@ class TDigitizer
 
   uint32_t GetNumberOfCh();
   uint32_t GetDeltaT();
+  // Shortest ch_pretrg of the configured channels (in ns) converted to
+  // samples and rounded down, 0 if not set
+  uint32_t GetPreTrigger();
+  std::string GetFirmware() const { return fFW; }
+  uint8_t GetModuleNumber() const { return fModNo; }
 
   void ForceTrace();
 
+  // Disarm, apply the changed parameters and re-arm this board only.
+  // Refused (false) when the board shares its clock or start with others,
+  // the restarted counter could not be aligned to them again.
+  bool Reconfigure(bool forceTrace);
+  bool IsTimeSynchronised();
+
+  // Control calls (open, config, arm, disarm, close) must run on the thread
+  // that opened the board, so each board owns one thread executing posted
+  // commands in order.  TDataTaking posts to all boards and waits.
+  template <typename F>
+  auto Post(F &&func) -> std::future<decltype(func())>
+  {
+    using Result_t = decltype(func());
+    auto task =
+        std::make_shared<std::packaged_task<Result_t()>>(std::forward<F>(func));
+    auto result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(fCommandMutex);
+      fCommands.emplace_back([task] { (*task)(); });
+    }
+    fCommandCond.notify_one();
+    return result;
+  }
+
+  // Packs the digital probes (one byte per sample from ReadData) and copies
+  // the hit into the batch, as the readout threads do
+  static void PushEvent(TEventData &eventData,
+                        const std::vector<uint8_t> &digitalProbe1,
+                        const std::vector<uint8_t> &digitalProbe2,
+                        std::vector<std::unique_ptr<TEventData>> &buf);
+
  private:
+  std::thread fOwnerThread;
+  std::deque<std::function<void()>> fCommands;
+  std::mutex fCommandMutex;
+  std::condition_variable fCommandCond;
+  bool fOwnerRunning = true;
+  void OwnerLoop();
+
   uint8_t fModNo = 0;
   uint64_t fHandle;
   uint64_t fReadDataHandle;
   nlohmann::json fParameters;
   std::string fFW;
-  int32_t fTimeOut = 100;
+  int32_t fTimeOut = 100;  // ms, ReadData wait while no hit is buffered
 
   std::unique_ptr<DAQData_t> fEventsVec;
+  std::size_t fLastEventsSize = 0;
   void MakeNewEventsVec();
   std::mutex fEventsDataMutex;
   std::thread fAcquisitionThread;
   bool fRunning = false;
 
-  uint32_t fEventThreshold = 1023;
+  // Re-arming restarts the time stamp counter. The wall clock time since
+  // the start of the run is added to timeStampNs of a re-armed board, so
+  // its hits stay on the time axis of the run (to about 1 ms).
+  uint64_t fRunStart = 0;  // ns, TPipelineStats::Now()
+  double fTimeOffset = 0.;  // ns, read by the readout thread at its start
+
+  // Adaptive batching of the readout threads, "ReadoutBatching" of the
+  // parameter file. A batch is flushed when its oldest hit is TargetLatency
+  // old or it holds TargetBatchBytes, so low rates get short latency and
+  // high rates few, large batches. ReadData waits at most until the
+  // deadline of the buffered hits. Read by the readout thread, so they are
+  // only set by StartAcquisition before it starts the thread.
+  double fTargetLatency = 10.;  // ms
+  uint64_t fTargetBatchBytes = 4 * 1024 * 1024;
+  void ApplyBatching();
+  uint32_t GetMaxBatchEvents(uint32_t recLen) const;
+  int32_t GetReadTimeOut(const std::vector<std::unique_ptr<TEventData>> &buf,
+                         uint64_t now) const;
+  bool IsBatchDue(const std::vector<std::unique_ptr<TEventData>> &buf,
+                  uint32_t maxEvents, uint64_t now) const;
+  void FlushEvents(std::vector<std::unique_ptr<TEventData>> &buf,
+                   uint64_t &nCalls, uint64_t &nTimeouts);
   void FetchEventsPSD();
   void FetchEventsPHA();
   void FetchEventsScope();
@@ -64,6 +136,20 @@ class TDigitizer
 
   bool GetParameter(std::string path, std::string &values) const;
   bool SetParameter(std::string path, std::string value) const;
+
+  // Last known value of every writable parameter, keyed by lower case path.
+  // Read from the device tree after opening and after ConfigDigitizer has
+  // written anything, so ConfigDigitizer only sends what differs.  Cleared
+  // by Reset.
+  std::unordered_map<std::string, std::string> fDeviceState;
+  void ReadDeviceState();
+  void FlattenDeviceTree(const nlohmann::json &node, const std::string &path);
+  bool ApplyParameter(const std::string &path, const std::string &value);
+  // Channels sharing a value are written with one /ch/a..b/par/X range path,
+  // one by one if the range is rejected
+  void ApplyChannelParameters();
+  uint32_t fNSent = 0;
+  uint32_t fNSkipped = 0;
 };
 
 #endif  // TDigitizer_HPP
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef TEnergyCalibrator_HPP
+#define TEnergyCalibrator_HPP 1
+
+// Online energy calibration with gain drift tracking
+// energyCal = c0 + c1 x + c2 x^2 + c3 x^3, x = energy * drift correction.
+// Per channel, a reference line at PeakPosition (ADC) is followed by an
+// exponential moving average of the hits within PeakWindow of the tracked
+// value (of PeakPosition until the first hit). Its ratio to
+// PeakPosition is the relative gain, shown in the monitor and optionally
+// divided out before calibrating.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TProcessingStage.hpp"
+
+class TEnergyCalibrator : public TProcessingStage
+{
+ public:
+  TEnergyCalibrator();
+  ~TEnergyCalibrator();
+
+  std::string GetName() const override { return "EnergyCalibration"; }
+  void LoadConf(const nlohmann::json &conf) override;
+  void Process(DAQData_t &data) override;
+
+  // Tracked peak / PeakPosition, 0 when the channel has no reference line
+  // or no hit in the window yet. Safe to call from other threads.
+  float GetRelativeGain(uint32_t module, uint32_t channel) const;
+
+ private:
+  static constexpr uint32_t kNCoefficients = 4;
+  uint16_t AddCalibration(const nlohmann::json &conf);
+
+  // Per calibration, fCalibrationIndex[(module << 8) | channel]
+  std::vector<float> fCoefficients[kNCoefficients];
+  std::vector<float> fPeakPosition;  // 0: no tracking
+  std::vector<float> fPeakWindow;
+  TChannelSettings fCalibrationIndex;
+  bool fDriftCorrection = false;
+  float fTrackingAlpha = 0.001f;
+
+  // Per channel, (module << 8) | channel
+  std::unique_ptr<std::atomic<float>[]> fTrackedPeak;
+  std::vector<float> fGainCorrection;
+  void TrackPeaks(uint32_t n);
+
+  // Columns of the current batch, reused
+  std::vector<float> fEnergy;
+  std::vector<uint16_t> fCalibration;
+  std::vector<uint16_t> fID;
+  std::vector<float> fEnergyCal;
+};
+
+#endif  // TEnergyCalibrator_HPP
@@ -2,9 +2,54 @@
 #ifndef TEventData_HPP
 #define TEventData_HPP 1
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+// Bits of qaFlags, set by TWaveformQA
+enum QAFlag : uint8_t {
+  kQASaturation = 1 << 0,
+  kQAPileUp = 1 << 1,
+  kQANoisyBaseline = 1 << 2,
+  kQAChecked = 1 << 7  // The trace was checked
+};
+
+// particleClass, set by TPSDClassifier
+enum ParticleClass : uint8_t {
+  kClassUnknown = 0,
+  kClassGamma = 1,
+  kClassNeutron = 2,
+  kNClasses = 3
+};
+inline constexpr const char *kParticleClassNames[kNClasses] = {
+    "Unknown", "Gamma", "Neutron"};
+
+// Digital probes are bit packed, sample i is bit i % 64 of word i / 64
+inline std::size_t DigitalProbeWords(std::size_t nSamples)
+{
+  return (nSamples + 63) / 64;
+}
+inline void PackDigitalProbe(const uint8_t *samples, std::size_t nSamples,
+                             uint64_t *words)
+{
+  const auto nWords = DigitalProbeWords(nSamples);
+  for (std::size_t iWord = 0; iWord < nWords; iWord++) {
+    const auto offset = iWord * 64;
+    const auto nBits = nSamples - offset < 64 ? nSamples - offset : 64;
+    uint64_t word = 0;
+#pragma omp simd reduction(| : word)
+    for (std::size_t iBit = 0; iBit < nBits; iBit++) {
+      word |= uint64_t(samples[offset + iBit] != 0) << iBit;
+    }
+    words[iWord] = word;
+  }
+}
+inline bool GetDigitalProbe(const std::vector<uint64_t> &words, std::size_t i)
+{
+  return (words[i / 64] >> (i % 64)) & 1;
+}
+
 class TEventData
 {
  public:
@@ -13,8 +58,8 @@ class TEventData
   {
     analogProbe1.resize(traceSize);
     analogProbe2.resize(traceSize);
-    digitalProbe1.resize(traceSize);
-    digitalProbe2.resize(traceSize);
+    digitalProbe1.resize(DigitalProbeWords(traceSize));
+    digitalProbe2.resize(DigitalProbeWords(traceSize));
   };
   TEventData(const TEventData &eventData)
   {
@@ -35,6 +80,10 @@ class TEventData
     digitalProbe2Type = eventData.digitalProbe2Type;
     waveformSize = eventData.waveformSize;
     eventSize = eventData.eventSize;
+    readoutTime = eventData.readoutTime;
+    qaFlags = eventData.qaFlags;
+    particleClass = eventData.particleClass;
+    energyCal = eventData.energyCal;
   };
   ~TEventData() {};
 
@@ -49,15 +98,25 @@ class TEventData
   int32_t analogProbe1Type;
   std::vector<int16_t> analogProbe2;
   int32_t analogProbe2Type;
-  std::vector<uint8_t> digitalProbe1;
+  std::vector<uint64_t> digitalProbe1;  // bit packed
   int32_t digitalProbe1Type;
-  std::vector<uint8_t> digitalProbe2;
+  std::vector<uint64_t> digitalProbe2;  // bit packed
   int32_t digitalProbe2Type;
   std::size_t waveformSize;
   uint32_t eventSize;
+  uint64_t readoutTime = 0;  // steady clock in ns when ReadData returned
+  uint8_t qaFlags = 0;
+  uint8_t particleClass = kClassUnknown;
+  float energyCal = 0.f;  // set by TEnergyCalibrator
 };
 typedef std::vector<std::unique_ptr<TEventData>> DAQData_t;
 
+// PSD = (ChargeLong - ChargeShort) / ChargeLong, 0 for no ChargeLong
+inline float PSDRatio(float energy, float energyShort)
+{
+  return energy > 0.f ? (energy - energyShort) / energy : 0.f;
+}
+
 class TSmallEventData
 {
  public:
@@ -70,7 +129,17 @@ class TSmallEventData
     energy = eventData.energy;
     energyShort = eventData.energyShort;
     waveform = eventData.waveform;
+    signalCodec = eventData.signalCodec;
+    analogProbe2 = eventData.analogProbe2;
+    analogProbe2Codec = eventData.analogProbe2Codec;
+    digitalProbe1 = eventData.digitalProbe1;
+    digitalProbe2 = eventData.digitalProbe2;
+    readoutTime = eventData.readoutTime;
+    qaFlags = eventData.qaFlags;
+    particleClass = eventData.particleClass;
+    energyCal = eventData.energyCal;
   };
+  TSmallEventData &operator=(const TSmallEventData &) = default;
   ~TSmallEventData() {};
 
   uint8_t module;
@@ -79,6 +148,15 @@ class TSmallEventData
   uint16_t energy;
   int16_t energyShort;
   std::vector<int16_t> waveform;
+  std::vector<uint8_t> signalCodec;  // waveform encoded by TWaveformCodec
+  std::vector<int16_t> analogProbe2;
+  std::vector<uint8_t> analogProbe2Codec;
+  std::vector<uint64_t> digitalProbe1;  // bit packed as in TEventData
+  std::vector<uint64_t> digitalProbe2;
+  uint64_t readoutTime = 0;  // Not recorded, only for latency monitoring
+  uint8_t qaFlags = 0;
+  uint8_t particleClass = kClassUnknown;
+  float energyCal = 0.f;
 };
 
 #endif  // TEventData_HPP
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef TEventFilter_HPP
+#define TEventFilter_HPP 1
+
+// Selection of hits before recording
+// Per channel cuts on energy, PSD ratio, qaFlags (RequireFlags, RejectFlags)
+// and the digitizer flags (RequireHWFlags, RejectHWFlags) from a JSON file.
+// A batch is evaluated column wise. The loop is a template instantiated for
+// each combination of active cut types, so unused cuts cost nothing and the
+// rest vectorises.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "TEventData.hpp"
+#include "TProcessingStage.hpp"
+
+class TEventFilter
+{
+ public:
+  TEventFilter();
+  ~TEventFilter();
+
+  void LoadConf(const std::string &fileName);
+  void LoadConf(const nlohmann::json &conf);
+
+  // pass[i] is 1 when data[i] is accepted
+  void Evaluate(const DAQData_t &data, std::vector<uint8_t> &pass);
+
+  // qaFlags stay 0 without the WaveformQA stage
+  bool UsesQAFlags() const { return fUseQAFlags; }
+
+  uint64_t GetNAccepted() const { return fNAccepted; }
+  uint64_t GetNRejected() const { return fNRejected; }
+
+ private:
+  struct Cut {
+    float energyMin = 0.f;
+    float energyMax = 1.e9f;
+    float psdMin = -1.e9f;
+    float psdMax = 1.e9f;
+    uint8_t requireFlags = 0;  // all of them must be set
+    uint8_t rejectFlags = 0;   // none of them may be set
+    uint32_t requireHWFlags = 0;
+    uint32_t rejectHWFlags = 0;
+  };
+  static Cut ParseCut(const nlohmann::json &conf, const Cut &base);
+  uint16_t AddCut(const Cut &cut);
+
+  // Cut table in columns, fCutIndex[(module << 8) | channel]
+  std::vector<float> fEnergyMin;
+  std::vector<float> fEnergyMax;
+  std::vector<float> fPSDMin;
+  std::vector<float> fPSDMax;
+  std::vector<uint8_t> fRequireFlags;
+  std::vector<uint8_t> fRejectFlags;
+  std::vector<uint32_t> fRequireHWFlags;
+  std::vector<uint32_t> fRejectHWFlags;
+  TChannelSettings fCutIndex;
+  bool fUseQAFlags = false;
+
+  template <bool kEnergy, bool kPSD, bool kFlags>
+  void EvaluateColumns(uint32_t n, uint8_t *pass) const;
+  typedef void (TEventFilter::*Kernel_t)(uint32_t, uint8_t *) const;
+  Kernel_t fKernel;
+
+  // Columns of the current batch, reused
+  std::vector<float> fEnergy;
+  std::vector<float> fPSD;
+  std::vector<uint8_t> fFlags;
+  std::vector<uint32_t> fHWFlags;
+  std::vector<uint16_t> fCut;
+
+  std::atomic<uint64_t> fNAccepted{0};
+  std::atomic<uint64_t> fNRejected{0};
+};
+
+#endif  // TEventFilter_HPP
@@ -0,0 +1,41 @@
+#ifndef TLatencyHistogram_HPP
+#define TLatencyHistogram_HPP 1
+
+// HDR-style latency histogram
+// Values (ns) are binned in power of 2 buckets, each split into linear
+// sub-buckets. Relative precision is 1 / kSubBuckets over the full 64 bit range.
+// Recording is lock free and can be called from any thread.
+
+#include <atomic>
+#include <cstdint>
+
+class TLatencyHistogram
+{
+ public:
+  TLatencyHistogram();
+  ~TLatencyHistogram();
+
+  void Record(uint64_t value);
+  void Reset();
+
+  uint64_t GetCount() const;
+  uint64_t GetMax() const;
+  double GetMean() const;
+  uint64_t GetPercentile(double percentile) const;
+
+  static constexpr uint32_t kSubBucketBits = 5;
+  static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr uint32_t kNBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static uint32_t GetBucketIndex(uint64_t value);
+  static uint64_t GetBucketLowEdge(uint32_t index);
+  uint64_t GetBucketCount(uint32_t index) const;
+
+ private:
+  std::atomic<uint64_t> fCounts[kNBuckets];
+  std::atomic<uint64_t> fTotalCount;
+  std::atomic<uint64_t> fSum;
+  std::atomic<uint64_t> fMax;
+};
+
+#endif  // TLatencyHistogram_HPP
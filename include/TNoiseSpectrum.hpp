@@ -0,0 +1,75 @@
+#ifndef TNoiseSpectrum_HPP
+#define TNoiseSpectrum_HPP 1
+
+// Averaged power spectra of the pre-trigger baseline per channel
+// Channels of modules whose pre-trigger is shorter than the spectrum are
+// skipped, their traces would include the pulse edge.
+// Fill tasks offer traces, every Nth trace of a channel is copied into
+// a short queue (dropped when full). One worker thread with the idle
+// scheduling policy runs the FFTs, so it never takes CPU from filling.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TChannelMap.hpp"
+
+class TNoiseSpectrum
+{
+ public:
+  // nSamples: first samples of the trace used, power of 2
+  // preTrigger: samples by module position, 0 or missing if unknown
+  TNoiseSpectrum(uint32_t nSamples, uint32_t decimation,
+                 const TChannelMap &channelMap,
+                 const std::vector<uint32_t> &preTrigger = {});
+  ~TNoiseSpectrum();
+
+  void Start();
+  void Stop();
+
+  uint32_t GetNSamples() const { return fNSamples; }
+  uint32_t GetNBins() const { return fNSamples / 2 + 1; }
+
+  // index: flat channel index of TChannelMap
+  // Cheap when the trace is not taken
+  void Offer(uint32_t index, const int16_t *wf, std::size_t n);
+  // Mean power (ADC^2) of each frequency bin, returns the number of spectra
+  uint64_t GetAverage(uint32_t index, std::vector<double> &power);
+  void Reset();
+
+ private:
+  uint32_t fNSamples;
+  uint32_t fDecimation;
+  uint32_t fNChannels;
+  std::vector<uint8_t> fUsable;  // pre-trigger fits the spectrum
+  std::unique_ptr<std::atomic<uint32_t>[]> fCounter;
+
+  struct Trace {
+    uint32_t index;
+    std::vector<int16_t> samples;
+  };
+  static constexpr std::size_t kMaxQueue = 256;
+  std::deque<Trace> fQueue;
+  std::mutex fQueueMutex;
+  std::condition_variable fQueueCV;
+
+  std::vector<std::vector<double>> fSum;
+  std::vector<uint64_t> fNSpectra;
+  std::mutex fSumMutex;
+
+  std::vector<float> fWindow;
+  float fWindowNorm;
+  std::vector<float> fCos;
+  std::vector<float> fSin;
+
+  std::atomic<bool> fRunning{false};
+  std::thread fWorker;
+  void WorkerThread();
+};
+
+#endif  // TNoiseSpectrum_HPP
@@ -0,0 +1,54 @@
+#ifndef TPSDClassifier_HPP
+#define TPSDClassifier_HPP 1
+
+// Online neutron/gamma classification from ChargeLong and the PSD ratio
+// Per channel cut, either a boundary psd(E) = p0 + p1 / sqrt(E) + p2 / E
+// (neutrons above) or a graphical cut polygon in (ChargeLong, PSD ratio)
+// (neutrons inside). Polygons are rasterised into a lookup map when loading,
+// so both cut types are evaluated in one vectorised pass over the batch.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "TProcessingStage.hpp"
+
+class TPSDClassifier : public TProcessingStage
+{
+ public:
+  TPSDClassifier();
+  ~TPSDClassifier();
+
+  std::string GetName() const override { return "PSDClassification"; }
+  void LoadConf(const nlohmann::json &conf) override;
+  void Process(DAQData_t &data) override;
+
+ private:
+  enum class CutType : uint8_t { None, Boundary, Polygon };
+  uint16_t AddCut(const nlohmann::json &conf);
+  uint32_t RasterisePolygon(const std::vector<std::vector<float>> &vertices);
+
+  // Cut table in columns, fCutIndex[(module << 8) | channel]
+  std::vector<uint8_t> fType;
+  std::vector<float> fEnergyMin;
+  std::vector<float> fP0;
+  std::vector<float> fP1;
+  std::vector<float> fP2;
+  std::vector<uint32_t> fMapOffset;
+  TChannelSettings fCutIndex;
+
+  // Polygon maps, fMapBins x fMapBins each, the first one is empty
+  uint32_t fMapBins = 256;
+  float fMapEnergyMax = 32768.f;
+  float fMapPSDMin = 0.f;
+  float fMapPSDMax = 1.f;
+  std::vector<uint8_t> fMaps;
+
+  // Columns of the current batch, reused
+  std::vector<float> fEnergy;
+  std::vector<float> fPSD;
+  std::vector<uint16_t> fCut;
+  std::vector<uint8_t> fClass;
+};
+
+#endif  // TPSDClassifier_HPP
@@ -0,0 +1,88 @@
+#ifndef TPipelineStats_HPP
+#define TPipelineStats_HPP 1
+
+// Latency of hits at each pipeline stage boundary
+// Every hit carries the time CAEN_FELib_ReadData returned (readoutTime).
+// At each boundary, the age of the oldest hit in the batch is recorded.
+// Differences between consecutive stages give the time spent in each stage.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "TLatencyHistogram.hpp"
+
+enum class PipelineStage {
+  DigitizerBuffer,  // TDigitizer flushes eventBuffer (adaptive batching)
+  Aggregation,      // TDataTaking::FetchingData merges all digitizers
+  Processing,       // TProcessingStage chain of TDataTaking is done
+  Dispatch,         // Main loop hands the data to monitor and recorder
+  Conversion,       // TDataRecorder::ConvertBatch converted a batch
+  Sort,             // TDataRecorder::ConvertBatch sorted a batch
+  Write,            // TTree::Fill of the batch is done
+  MonitorFill,      // TDataMonitor::FillBatch filled a batch
+  NStages
+};
+
+// CAEN_FELib_ReadData calls of one board, added by the readout thread at
+// every flush of its batch
+struct TReadoutStats {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> timeouts{0};
+  std::atomic<uint64_t> events{0};
+  std::atomic<uint64_t> batches{0};
+};
+
+class TPipelineStats
+{
+ public:
+  static TPipelineStats &GetInstance();
+
+  // Steady clock in ns, same origin for all threads
+  static uint64_t Now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static const char *GetStageName(PipelineStage stage);
+
+  void RecordLatency(PipelineStage stage, uint64_t readoutTime);
+
+  template <typename T>
+  void RecordBatch(PipelineStage stage, const T &batch)
+  {
+    if (batch.empty()) return;
+    auto oldest = batch.front()->readoutTime;
+    for (const auto &event : batch) {
+      if (event->readoutTime < oldest) oldest = event->readoutTime;
+    }
+    RecordLatency(stage, oldest);
+  }
+
+  TLatencyHistogram &GetLatency(PipelineStage stage);
+
+  void RecordReadout(uint8_t module, uint64_t calls, uint64_t timeouts,
+                     uint64_t events);
+  const TReadoutStats &GetReadout(uint8_t module) const
+  {
+    return fReadout[module];
+  }
+
+  void Reset();
+  void Print() const;
+
+ private:
+  TPipelineStats();
+  ~TPipelineStats();
+  TPipelineStats(const TPipelineStats &) = delete;
+  TPipelineStats &operator=(const TPipelineStats &) = delete;
+
+  static constexpr auto kNStages = static_cast<size_t>(PipelineStage::NStages);
+  std::array<TLatencyHistogram, kNStages> fLatency;
+  std::array<TReadoutStats, 256> fReadout;  // by module ID
+};
+
+#endif  // TPipelineStats_HPP
@@ -0,0 +1,84 @@
+#ifndef TProcessingStage_HPP
+#define TProcessingStage_HPP 1
+
+// Interface of the processing stages between readout and dispatch
+// TDataTaking::FetchingData calls Process() with every aggregated batch,
+// before it is handed to the main loop. Stages parallelise over the hits of
+// the batch with OpenMP.
+
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "TEventData.hpp"
+
+class TProcessingStage
+{
+ public:
+  virtual ~TProcessingStage() {};
+
+  virtual std::string GetName() const = 0;
+  virtual void LoadConf(const nlohmann::json &conf) = 0;
+  virtual void Process(DAQData_t &data) = 0;
+};
+
+// Per channel lookup of settings, index is (module << 8) | channel
+// "Default" for all channels, "Modules": {"ID": {"Default": {},
+// "Channels": {"ch": {}}}} overrides by module and channel. Objects are
+// merged into the level above, other values replace it. Every distinct
+// setting is passed once to addEntry(json), which stores it (usually as
+// columns) and returns its index.
+class TChannelSettings
+{
+ public:
+  static constexpr uint32_t kSize = 1 << 16;
+  static uint32_t GetID(uint32_t module, uint32_t channel)
+  {
+    return (module << 8) | channel;
+  }
+
+  template <typename AddEntry>
+  void Load(const nlohmann::json &conf, AddEntry addEntry)
+  {
+    auto defaultConf = conf.value("Default", nlohmann::json::object());
+    Assign(addEntry(defaultConf));
+    if (!conf.contains("Modules")) return;
+    for (auto &mod : conf["Modules"].items()) {
+      auto id = std::stoi(mod.key());
+      if (id < 0 || id > 255) continue;
+      auto modConf = defaultConf;
+      if (mod.value().contains("Default")) {
+        modConf = Merge(modConf, mod.value()["Default"]);
+        auto index = addEntry(modConf);
+        for (auto ch = 0; ch < 256; ch++) fIndex[GetID(id, ch)] = index;
+      }
+      if (mod.value().contains("Channels")) {
+        for (auto &ch : mod.value()["Channels"].items()) {
+          auto chID = std::stoi(ch.key());
+          if (chID < 0 || chID > 255) continue;
+          fIndex[GetID(id, chID)] = addEntry(Merge(modConf, ch.value()));
+        }
+      }
+    }
+  }
+
+  // All channels to one entry
+  void Assign(uint16_t index) { fIndex.assign(kSize, index); }
+  uint16_t operator[](uint32_t id) const { return fIndex[id]; }
+
+ private:
+  static nlohmann::json Merge(nlohmann::json base,
+                              const nlohmann::json &override)
+  {
+    if (base.is_object() && override.is_object())
+      base.update(override);
+    else
+      base = override;
+    return base;
+  }
+
+  std::vector<uint16_t> fIndex = std::vector<uint16_t>(kSize, 0);
+};
+
+#endif  // TProcessingStage_HPP
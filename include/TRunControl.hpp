@@ -0,0 +1,53 @@
+#ifndef TRunControl_HPP
+#define TRunControl_HPP 1
+
+// Run control commands, one per line, from a named pipe and the terminal
+//   quit | q              stop everything and exit
+//   reload [ID] | r [ID]  reload changed boards, or only module ID
+//   trace | t             dump the trace (DIGICON_TRACE builds)
+//   start, stop           start and stop the run (acquisition and recorder)
+//   file NAME             file name of the recorder
+// e.g. echo "reload 3" > digicon.ctl
+// The terminal is line buffered, so keys such as q need Enter.
+// A listener thread blocks in poll(), so the main loop does not poll.
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum class RunCommand { Quit, Reload, DumpTrace, StartRun, StopRun, FileName };
+
+class TRunControl
+{
+ public:
+  TRunControl();
+  ~TRunControl();
+
+  // The FIFO is created if it does not exist, "" for terminal only
+  void Start(const std::string &fifoName, bool useStdin = true);
+  void Stop();
+
+  // Called by the listener thread when a command is queued
+  void SetNotify(const std::function<void()> &notify) { fNotify = notify; }
+
+  // False if no command is queued
+  bool PopCommand(RunCommand &command, std::string &argument);
+
+ private:
+  std::string fFIFOName;
+  int fFIFO = -1;
+  int fStdin = -1;
+  int fWakePipe[2] = {-1, -1};
+
+  std::thread fListenThread;
+  void ListenThread();
+  void ParseLine(const std::string &line);
+
+  std::deque<std::pair<RunCommand, std::string>> fCommands;
+  std::mutex fCommandsMutex;
+  std::function<void()> fNotify;
+};
+
+#endif  // TRunControl_HPP
@@ -0,0 +1,108 @@
+#ifndef TTaskScheduler_HPP
+#define TTaskScheduler_HPP 1
+
+// Shared work-stealing pool for batch tasks of the recorder and the monitor
+// Each worker owns a deque of ready tasks, idle workers steal from the
+// others and sleep when nothing is ready, so CPU use follows the load.
+// Tasks are submitted to a named queue (one per stage). A queue runs at
+// most MinConcurrency tasks at once, plus one per QueueDepthPerThread
+// waiting tasks, up to MaxConcurrency.
+//
+// Pipeline.json
+//   "Scheduler": {"Threads": 16,
+//                 "Queues": {"Conversion": {"MaxConcurrency": 8}, ...}}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TTaskScheduler
+{
+ public:
+  static TTaskScheduler &GetInstance();
+
+  // Before the first Submit
+  void LoadConf(const nlohmann::json &conf);
+
+  class Queue;
+  // Created on first use with the configured or default limits
+  Queue *GetQueue(const std::string &name);
+
+  void Submit(Queue *queue, std::function<void()> task);
+  // Until all tasks submitted to the queue are done, not from a task
+  void Wait(Queue *queue);
+
+  uint32_t GetNThreads() const { return fNThreads; }
+  void Print();
+
+  class Queue
+  {
+   public:
+    const std::string &GetName() const { return fName; }
+    uint32_t GetNRunning();
+    uint32_t GetNPending();
+
+   private:
+    friend class TTaskScheduler;
+    std::string fName;
+    uint32_t fMinConcurrency = 1;
+    uint32_t fMaxConcurrency = 1;
+    uint32_t fDepthPerThread = 1;
+    uint32_t AllowedConcurrency() const;
+
+    std::mutex fMutex;
+    std::condition_variable fDoneCV;
+    std::deque<std::function<void()>> fPending;
+    uint32_t fNRunning = 0;
+    uint64_t fNOutstanding = 0;  // Pending and running
+    uint32_t fPeakRunning = 0;
+    uint64_t fNTasks = 0;
+  };
+
+ private:
+  TTaskScheduler();
+  ~TTaskScheduler();
+  TTaskScheduler(const TTaskScheduler &) = delete;
+  TTaskScheduler &operator=(const TTaskScheduler &) = delete;
+
+  struct Task {
+    Queue *queue;
+    std::function<void()> func;
+  };
+  struct Worker {
+    std::deque<Task> ready;
+    std::mutex mutex;
+  };
+
+  uint32_t fNThreads;
+  nlohmann::json fQueueConf;
+  std::map<std::string, std::unique_ptr<Queue>> fQueues;
+  std::mutex fQueuesMutex;
+
+  std::vector<std::unique_ptr<Worker>> fWorkers;
+  std::vector<std::thread> fThreads;
+  std::once_flag fStartFlag;
+  void StartWorkers();
+  void WorkerLoop(uint32_t index);
+
+  std::atomic<uint64_t> fNReady{0};
+  std::atomic<uint32_t> fNextWorker{0};
+  std::mutex fSleepMutex;
+  std::condition_variable fSleepCV;
+  bool fStop = false;
+
+  void PushReady(Task task);
+  bool PopTask(uint32_t index, Task &task);
+  void Finish(Queue *queue);
+};
+
+#endif  // TTaskScheduler_HPP
@@ -0,0 +1,50 @@
+#ifndef TThreadAffinity_HPP
+#define TThreadAffinity_HPP 1
+
+// CPU placement of the threads by role
+// A CPU set is a Linux cpulist ("0-7,16-23") or a NUMA node ("node1").
+// Memory is allocated on the node of the thread first touching it, so a
+// readout thread pinned to the socket of its NIC fills its batches there.
+//
+// Pipeline.json
+//   "Affinity": {"Readout": {"Default": "node0", "Modules": {"11": "node1"}},
+//                "Fetching": "node0", "Workers": "0-13", "Monitor": "14-15"}
+// Readout: TDigitizer::FetchEvents*, Fetching: TDataTaking::FetchingData,
+// Workers: TTaskScheduler (conversion, writing, monitor filling),
+// Monitor: ROOT event loop of TDataMonitor.
+
+#include <cstdint>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+class TThreadAffinity
+{
+ public:
+  static TThreadAffinity &GetInstance();
+
+  void LoadConf(const nlohmann::json &conf);
+
+  // Pin the calling thread, nothing for roles not configured
+  void Apply(const std::string &role) const;
+  void ApplyReadout(uint8_t module) const;
+
+  // Empty for a malformed list or an unknown node
+  static std::vector<int> ParseCPUSet(const std::string &spec);
+  // -1 if the system has no NUMA information
+  static int GetNode(int cpu);
+
+ private:
+  TThreadAffinity() {};
+  TThreadAffinity(const TThreadAffinity &) = delete;
+  TThreadAffinity &operator=(const TThreadAffinity &) = delete;
+
+  std::map<std::string, std::vector<int>> fRoleCPUs;
+  std::vector<int> fReadoutDefault;
+  std::map<uint8_t, std::vector<int>> fReadoutCPUs;
+
+  static bool Pin(const std::vector<int> &cpus, const std::string &name);
+};
+
+#endif  // TThreadAffinity_HPP
@@ -0,0 +1,95 @@
+#ifndef TTrace_HPP
+#define TTrace_HPP 1
+
+// Timeline tracing of the DAQ threads
+// Spans are stored into per-thread ring buffers and dumped as Chrome
+// trace-event JSON (chrome://tracing or https://ui.perfetto.dev).
+// The TRACE_* macros are empty unless built with -DDIGICON_TRACE=ON.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TTrace
+{
+ public:
+  static TTrace &GetInstance();
+
+  void SetThreadName(const std::string &name);
+  // name must be a string literal (only the pointer is stored)
+  void AddSpan(const char *name, uint64_t start, uint64_t end);
+  void AddInstant(const char *name);
+
+  bool Dump(const std::string &fileName);
+
+ private:
+  TTrace();
+  ~TTrace();
+  TTrace(const TTrace &) = delete;
+  TTrace &operator=(const TTrace &) = delete;
+
+  struct TraceEvent {
+    const char *name;
+    uint64_t start;     // ns, TPipelineStats::Now()
+    uint64_t duration;  // ns, 0 for instant events
+    bool instant;
+  };
+
+  // Only the owner thread writes. Dumping while threads are running can
+  // show a torn event at the ring boundary, which is acceptable for a
+  // debugging tool.
+  struct ThreadBuffer {
+    uint32_t tid;
+    std::string name;  // empty for unnamed threads
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head{0};
+    bool inUse = false;  // guarded by fBuffersMutex
+  };
+  static constexpr uint32_t kBufferSize = 1 << 16;  // events per thread
+
+  // Returns the buffer to the pool when its thread exits
+  struct BufferHandle {
+    ThreadBuffer *buffer = nullptr;
+    ~BufferHandle();
+  };
+  static BufferHandle &GetHandle();
+
+  ThreadBuffer &GetThreadBuffer();
+  ThreadBuffer *AcquireBuffer(const std::string &name);
+  void ReleaseBuffer(ThreadBuffer *buffer);
+  void Push(const TraceEvent &event);
+
+  uint64_t fOrigin;
+  std::mutex fBuffersMutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> fBuffers;
+};
+
+class TTraceScope
+{
+ public:
+  explicit TTraceScope(const char *name);
+  ~TTraceScope();
+
+ private:
+  const char *fName;
+  uint64_t fStart;
+};
+
+#ifdef DIGICON_TRACE
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) TTraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name) TTrace::GetInstance().AddInstant(name)
+#define TRACE_THREAD_NAME(name) TTrace::GetInstance().SetThreadName(name)
+#define TRACE_DUMP(fileName) TTrace::GetInstance().Dump(fileName)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_DUMP(fileName)
+#endif
+
+#endif  // TTrace_HPP
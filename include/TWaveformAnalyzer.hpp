@@ -0,0 +1,51 @@
+#ifndef TWaveformAnalyzer_HPP
+#define TWaveformAnalyzer_HPP 1
+
+// Online energy and timing from traces (SCOPE firmware)
+// Fills energy (long gate or trapezoid), energyShort (short gate) and refines
+// timeStampNs with a digital CFD, using analogProbe1.
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "TProcessingStage.hpp"
+
+class TWaveformAnalyzer : public TProcessingStage
+{
+ public:
+  TWaveformAnalyzer();
+  ~TWaveformAnalyzer();
+
+  std::string GetName() const override { return "WaveformAnalysis"; }
+  void LoadConf(const nlohmann::json &conf) override;
+  void Process(DAQData_t &data) override;
+
+ private:
+  struct Settings {
+    bool enabled = false;
+    float polarity = -1.f;         // -1 for negative pulses
+    uint32_t baselineSamples = 64;
+    uint32_t preTrigger = 100;     // samples before the trigger
+    float samplingPeriod = 2.f;    // ns
+    int32_t gateOffset = -8;       // gate start from the CFD time, samples
+    uint32_t longGate = 200;       // samples
+    uint32_t shortGate = 40;       // samples
+    bool useTrapezoid = false;     // energy from trapezoid instead of charge
+    uint32_t trapRise = 50;
+    uint32_t trapFlat = 20;
+    float decayTau = 0.f;          // samples
+    float energyScale = 1.f;
+    bool useCRRC = false;          // shape before CFD
+    float shapingTau = 4.f;        // samples
+    float cfdFraction = 0.3f;
+    uint32_t cfdDelay = 4;         // samples
+    float threshold = 50.f;        // ADC after baseline subtraction
+  };
+  static Settings ParseSettings(const nlohmann::json &conf,
+                                const Settings &base);
+
+  std::array<Settings, 256> fSettings;  // index is module ID
+};
+
+#endif  // TWaveformAnalyzer_HPP
@@ -0,0 +1,39 @@
+#ifndef TWaveformCodec_HPP
+#define TWaveformCodec_HPP 1
+
+// Lossless codec of digitizer traces
+// Sample differences are zigzag encoded and bit packed in blocks of
+// kBlockSize. Each block stores its bit width (1 byte) and then one 32 bit
+// word per bit plane, bit i of plane j is bit j of residual i. Packing and
+// unpacking are plain loops over the block and vectorise.
+// Layout: uint32 nSamples, int16 first sample, blocks. Little endian.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TWaveformCodec
+{
+ public:
+  static constexpr uint32_t kBlockSize = 32;
+
+  // Appends the encoded trace to out
+  static void Encode(const int16_t *wf, uint32_t n, std::vector<uint8_t> &out);
+  // Returns false for a truncated or broken buffer
+  static bool Decode(const uint8_t *in, std::size_t size,
+                     std::vector<int16_t> &wf);
+  static bool Decode(const std::vector<uint8_t> &in, std::vector<int16_t> &wf)
+  {
+    return Decode(in.data(), in.size(), wf);
+  }
+
+  // Upper limit of the encoded size, for reserving
+  static std::size_t MaxEncodedSize(uint32_t n);
+
+ private:
+  static uint32_t PackBlock(const uint32_t *values, uint32_t *planes);
+  static void UnpackBlock(const uint32_t *planes, uint32_t width,
+                          uint32_t *values);
+};
+
+#endif  // TWaveformCodec_HPP
@@ -0,0 +1,66 @@
+#ifndef TWaveformDSP_HPP
+#define TWaveformDSP_HPP 1
+
+// DSP kernels for digitizer traces
+// Loops are written for OpenMP SIMD. On x86-64 each kernel is compiled for
+// AVX-512, AVX2 and the baseline ISA, the best one is selected at run time.
+// Recursive filters (trapezoid, CR-RC) are vectorised where the recursion
+// allows it, the accumulation itself is sequential.
+
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define DSP_TARGET_CLONES \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define DSP_TARGET_CLONES
+#endif
+
+class TWaveformDSP
+{
+ public:
+  // Mean of the first n samples
+  static float Baseline(const int16_t *wf, uint32_t n);
+  // Smallest and largest sample
+  static void MinMax(const int16_t *wf, uint32_t n, int16_t &min,
+                     int16_t &max);
+  // RMS of the first n samples around the baseline
+  static float BaselineRMS(const int16_t *wf, uint32_t n, float baseline);
+
+  // (wf - baseline) * polarity, pulses become positive
+  static void ToFloat(const int16_t *wf, float *out, uint32_t n,
+                      float baseline, float polarity);
+
+  static float Max(const float *in, uint32_t n, uint32_t &position);
+
+  // Sum of in[start, start + length)
+  static float Integrate(const float *in, uint32_t n, int32_t start,
+                         uint32_t length);
+
+  // Trapezoidal shaper with pole-zero correction (tau in samples, 0 for step
+  // like input). Flat top height is the pulse amplitude.
+  static void Trapezoid(const float *in, float *work, float *out, uint32_t n,
+                        uint32_t rise, uint32_t flat, float tau);
+
+  // CR-RC shaper with the same time constant for both (tau in samples)
+  static void CRRC(const float *in, float *out, uint32_t n, float tau);
+
+  // Digital CFD: fraction * in[k] - in[k - delay].
+  // Returns the interpolated zero crossing after the signal exceeds the
+  // threshold, in samples, or -1 if not found.
+  static float CFD(const float *in, float *work, uint32_t n, float fraction,
+                   uint32_t delay, float threshold);
+
+  // Number of leading edges: in[k] - in[k - rise] crosses the threshold
+  // upwards, then no new edge for holdOff samples
+  static uint32_t CountEdges(const float *in, float *work, uint32_t n,
+                             uint32_t rise, float threshold, uint32_t holdOff);
+
+  // Twiddle factors of FFT for n points, n / 2 entries each
+  static void FFTTables(uint32_t n, float *cosTable, float *sinTable);
+  // In place radix-2 FFT, n must be a power of 2
+  static void FFT(float *re, float *im, uint32_t n, const float *cosTable,
+                  const float *sinTable);
+};
+
+#endif  // TWaveformDSP_HPP
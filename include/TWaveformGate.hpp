@@ -0,0 +1,58 @@
+#ifndef TWaveformGate_HPP
+#define TWaveformGate_HPP 1
+
+// Decides which hits keep their traces in the recorded data
+// A trace is kept when any rule passes: every Nth hit of the channel
+// (prescale), a hit of a reference channel within the coincidence window,
+// or qaFlags matching the QA mask. Scalars are recorded for every hit.
+// The decision is made when the batch is evaluated: references of the same
+// and the previous batch are searched, so a hit whose reference arrives
+// only in the next batch loses its trace.
+// Not thread safe, call from one thread in time order of the batches.
+
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "TEventData.hpp"
+#include "TProcessingStage.hpp"
+
+class TWaveformGate
+{
+ public:
+  TWaveformGate();
+  ~TWaveformGate();
+
+  void LoadConf(const std::string &fileName);
+  void LoadConf(const nlohmann::json &conf);
+
+  // keep[i] is 1 when the trace of data[i] is recorded
+  // Hits with select[i] == 0 (e.g. rejected by TEventFilter) are skipped
+  void Evaluate(const DAQData_t &data, std::vector<uint8_t> &keep,
+                const std::vector<uint8_t> *select = nullptr);
+
+  uint64_t GetNKept() const { return fNKept; }
+  uint64_t GetNDropped() const { return fNDropped; }
+
+ private:
+  std::vector<uint32_t> fPrescale;  // 0: rule off for the channel
+  TChannelSettings fPrescaleIndex;
+  // Index is (module << 8) | channel
+  std::vector<uint32_t> fCounter;
+  std::vector<uint8_t> fIsReference;
+
+  double fCoincidenceWindow = 0.;  // ns, 0: rule off
+  uint8_t fQAMask = 0;             // 0: rule off
+
+  // Reference times of this and the previous batch, sorted.  Later
+  // references are not known yet when a hit is decided.
+  std::vector<double> fRefTimes;
+  std::vector<double> fLastRefTimes;
+  bool InCoincidence(double time) const;
+
+  uint64_t fNKept = 0;
+  uint64_t fNDropped = 0;
+};
+
+#endif  // TWaveformGate_HPP
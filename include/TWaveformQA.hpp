@@ -0,0 +1,42 @@
+#ifndef TWaveformQA_HPP
+#define TWaveformQA_HPP 1
+
+// Online quality flags of traces
+// Sets qaFlags (TEventData.hpp) from analogProbe1: ADC saturation,
+// secondary leading edges (pile-up) and baseline RMS above the limit.
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "TProcessingStage.hpp"
+
+class TWaveformQA : public TProcessingStage
+{
+ public:
+  TWaveformQA();
+  ~TWaveformQA();
+
+  std::string GetName() const override { return "WaveformQA"; }
+  void LoadConf(const nlohmann::json &conf) override;
+  void Process(DAQData_t &data) override;
+
+ private:
+  struct Settings {
+    bool enabled = false;
+    int16_t saturationLow = 0;
+    int16_t saturationHigh = 16383;  // 14 bit ADC
+    uint32_t baselineSamples = 64;
+    float maxBaselineRMS = 5.f;  // ADC
+    float polarity = -1.f;       // -1 for negative pulses
+    uint32_t edgeRise = 4;       // samples
+    float edgeThreshold = 50.f;  // ADC
+    uint32_t edgeHoldOff = 16;   // samples
+  };
+  static Settings ParseSettings(const nlohmann::json &conf,
+                                const Settings &base);
+
+  std::array<Settings, 256> fSettings;  // index is module ID
+};
+
+#endif  // TWaveformQA_HPP
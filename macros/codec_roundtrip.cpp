@@ -0,0 +1,70 @@
+// This macro encodes and decodes test traces with TWaveformCodec and checks
+// that they come back unchanged, and that broken buffers are rejected
+// From the top directory (TWaveformCodec.hpp is found in include/):
+// root -l -b -q -e '.include include' macros/codec_roundtrip.cpp
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/TWaveformCodec.cpp"
+
+bool CheckRoundTrip(const std::string &name, const std::vector<int16_t> &wf)
+{
+  std::vector<uint8_t> codec;
+  TWaveformCodec::Encode(wf.data(), wf.size(), codec);
+  std::vector<int16_t> decoded;
+  auto ok = TWaveformCodec::Decode(codec, decoded) && decoded == wf;
+  std::cout << (ok ? "OK     " : "FAILED ") << name << ": " << wf.size()
+            << " samples, " << codec.size() << " bytes" << std::endl;
+  return ok;
+}
+
+bool CheckRejected(const std::string &name, const std::vector<uint8_t> &codec)
+{
+  std::vector<int16_t> decoded;
+  auto ok = !TWaveformCodec::Decode(codec, decoded);
+  std::cout << (ok ? "OK     " : "FAILED ") << name << " rejected"
+            << std::endl;
+  return ok;
+}
+
+int codec_roundtrip()
+{
+  std::mt19937 rng(1234);
+  auto nFailed = 0;
+
+  // Full int16 range, the largest differences need 17 bits
+  std::uniform_int_distribution<int> full(-32768, 32767);
+  std::vector<int16_t> wf(1000);
+  for (auto &x : wf) x = full(rng);
+  nFailed += !CheckRoundTrip("Random", wf);
+
+  // Pulse on a noisy baseline, not a multiple of the block size
+  std::normal_distribution<double> noise(0., 3.);
+  wf.resize(1027);
+  for (auto i = 0U; i < wf.size(); i++) {
+    auto pulse = i < 100 ? 0. : -4000. * std::exp(-(i - 100.) / 50.);
+    wf[i] = static_cast<int16_t>(8000. + pulse + noise(rng));
+  }
+  nFailed += !CheckRoundTrip("Pulse", wf);
+
+  nFailed += !CheckRoundTrip("Constant", std::vector<int16_t>(512, 8000));
+  nFailed += !CheckRoundTrip("OneSample", std::vector<int16_t>(1, -5));
+  nFailed += !CheckRoundTrip("Empty", std::vector<int16_t>());
+
+  // Broken buffers
+  std::vector<uint8_t> codec;
+  TWaveformCodec::Encode(wf.data(), wf.size(), codec);
+  nFailed += !CheckRejected("Header only", {codec.begin(), codec.begin() + 3});
+  nFailed += !CheckRejected("Truncated", {codec.begin(), codec.end() - 1});
+  const uint32_t huge = 0xFFFFFFFF;
+  std::memcpy(codec.data(), &huge, sizeof(huge));
+  nFailed += !CheckRejected("Sample count", codec);
+
+  std::cout << (nFailed == 0 ? "All passed" : "Failed") << std::endl;
+  return nFailed;
+}
@@ -0,0 +1,37 @@
+// This macro reads the "SignalCodec" branch written with the -z option
+// and decodes the traces with TWaveformCodec
+// From the top directory (TWaveformCodec.hpp is found in include/):
+// root -l -e '.include include' 'macros/decode_signal.cpp("test_data_0.root")'
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "../src/TWaveformCodec.cpp"
+
+void decode_signal(const char *fileName, Long64_t nEvents = 10)
+{
+  auto file = TFile::Open(fileName);
+  if (!file || file->IsZombie()) return;
+  auto tree = file->Get<TTree>("data");
+  if (!tree) return;
+
+  std::vector<uint8_t> *codec = nullptr;
+  tree->SetBranchAddress("SignalCodec", &codec);
+
+  std::vector<int16_t> signal;
+  nEvents = std::min(nEvents, tree->GetEntries());
+  for (Long64_t i = 0; i < nEvents; i++) {
+    tree->GetEntry(i);
+    if (!TWaveformCodec::Decode(*codec, signal)) {
+      std::cerr << "Broken trace at entry " << i << std::endl;
+      continue;
+    }
+    std::cout << i << ": " << signal.size() << " samples, " << codec->size()
+              << " bytes" << std::endl;
+  }
+  file->Close();
+}
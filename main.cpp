@@ -1,50 +1,35 @@
 #include <TROOT.h>
 #include <TSystem.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <termios.h>
 
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <nlohmann/json.hpp>
 #include <random>
+#include <sstream>
 
+#include "TClockAligner.hpp"
 #include "TDataMonitor.hpp"
 #include "TDataRecorder.hpp"
 #include "TDataTaking.hpp"
 #include "TDigitizer.hpp"
+#include "TEnergyCalibrator.hpp"
 #include "TEventData.hpp"
-
-enum class AppState { Quit, Reload, Continue };
-
-AppState InputCheck()
-{
-  struct termios oldt, newt;
-  char ch = -1;
-  int oldf;
-
-  tcgetattr(STDIN_FILENO, &oldt);
-  newt = oldt;
-  newt.c_lflag &= ~(ICANON | ECHO);
-  tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-  oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-
-  ch = getchar();
-
-  tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-  fcntl(STDIN_FILENO, F_SETFL, oldf);
-
-  if (ch == 'q' || ch == 'Q') {
-    return AppState::Quit;
-  } else if (ch == 'r' || ch == 'R') {
-    return AppState::Reload;
-  }
-
-  return AppState::Continue;
-}
+#include "TEventFilter.hpp"
+#include "TPSDClassifier.hpp"
+#include "TPipelineStats.hpp"
+#include "TProcessingStage.hpp"
+#include "TRunControl.hpp"
+#include "TTaskScheduler.hpp"
+#include "TThreadAffinity.hpp"
+#include "TTrace.hpp"
+#include "TWaveformAnalyzer.hpp"
+#include "TWaveformGate.hpp"
+#include "TWaveformQA.hpp"
 
 std::unique_ptr<DAQData_t> GetFakeEvents(uint32_t nEvents = 10000)
 {
@@ -66,35 +51,170 @@ std::unique_ptr<DAQData_t> GetFakeEvents(uint32_t nEvents = 10000)
     event->energy = energyDist(gen);
     event->energyShort = energyShortDist(gen);
     event->waveformSize = 0;
+    event->readoutTime = TPipelineStats::Now();
     events->push_back(std::move(event));
   }
 
   return events;
 }
 
+// "AP1,DP1" -> kRecordAnalogProbe1 | kRecordDigitalProbe1
+uint8_t ParseProbeList(const std::string &list)
+{
+  uint8_t probes = 0;
+  std::stringstream ss(list);
+  std::string probe;
+  while (std::getline(ss, probe, ',')) {
+    if (probe == "AP1") {
+      probes |= kRecordAnalogProbe1;
+    } else if (probe == "AP2") {
+      probes |= kRecordAnalogProbe2;
+    } else if (probe == "DP1") {
+      probes |= kRecordDigitalProbe1;
+    } else if (probe == "DP2") {
+      probes |= kRecordDigitalProbe2;
+    } else {
+      std::cerr << "Unknown probe " << probe << ", use AP1, AP2, DP1, DP2"
+                << std::endl;
+      exit(1);
+    }
+  }
+  return probes;
+}
+
+std::vector<std::shared_ptr<TProcessingStage>> LoadPipelineConf(
+    const std::string &fileName)
+{
+  std::vector<std::shared_ptr<TProcessingStage>> stages;
+  if (fileName == "") return stages;
+
+  std::ifstream fin(fileName);
+  if (!fin) {
+    std::cerr << "Pipeline configuration " << fileName << " not found"
+              << std::endl;
+    exit(1);
+  }
+  nlohmann::json conf;
+  fin >> conf;
+  fin.close();
+
+  if (conf.contains("Affinity")) {
+    TThreadAffinity::GetInstance().LoadConf(conf["Affinity"]);
+  }
+  if (conf.contains("Scheduler")) {
+    TTaskScheduler::GetInstance().LoadConf(conf["Scheduler"]);
+  }
+
+  // The order of the stages is fixed, not the order in the file
+  if (conf.contains("WaveformAnalysis")) {
+    auto stage = std::make_shared<TWaveformAnalyzer>();
+    stage->LoadConf(conf["WaveformAnalysis"]);
+    stages.push_back(stage);
+  }
+  if (conf.contains("WaveformQA")) {
+    auto stage = std::make_shared<TWaveformQA>();
+    stage->LoadConf(conf["WaveformQA"]);
+    stages.push_back(stage);
+  }
+  if (conf.contains("PSDClassification")) {
+    auto stage = std::make_shared<TPSDClassifier>();
+    stage->LoadConf(conf["PSDClassification"]);
+    stages.push_back(stage);
+  }
+  if (conf.contains("EnergyCalibration")) {
+    auto stage = std::make_shared<TEnergyCalibrator>();
+    stage->LoadConf(conf["EnergyCalibration"]);
+    stages.push_back(stage);
+  }
+  // After the timing of WaveformAnalysis
+  if (conf.contains("ClockAlignment")) {
+    auto stage = std::make_shared<TClockAligner>();
+    stage->LoadConf(conf["ClockAlignment"]);
+    stages.push_back(stage);
+  }
+
+  for (const auto &stage : stages) {
+    std::cout << "Processing stage: " << stage->GetName() << std::endl;
+  }
+  return stages;
+}
+
 int main(int argc, char *argv[])
 {
   ROOT::EnableThreadSafety();
 
   bool forceTrace = false;
   bool useTestData = false;
+  bool compressWaveform = false;
+  bool splitClasses = false;
+  uint8_t recordProbes = kRecordAnalogProbe1;
   // bool useTestData = true;
 
   std::string configList = "configList";
+  std::string monitorConf = "";
+  std::string pipelineConf = "";
+  std::string filterConf = "";
+  std::string gateConf = "";
+  std::string controlFIFO = "digicon.ctl";
   if (argc > 1) {
+    auto lastValueArg = 0;
     for (auto i = 1; i < argc; i++) {
       if (std::string(argv[i]) == "-w") {
         forceTrace = true;
       } else if (std::string(argv[i]) == "-t") {
         useTestData = true;
+      } else if (std::string(argv[i]) == "-z") {
+        compressWaveform = true;
+      } else if (std::string(argv[i]) == "-s") {
+        splitClasses = true;
+      } else if (std::string(argv[i]) == "-r" && i + 1 < argc) {
+        recordProbes = ParseProbeList(argv[++i]);
+        lastValueArg = i;
+      } else if (std::string(argv[i]) == "-m" && i + 1 < argc) {
+        monitorConf = argv[++i];
+        lastValueArg = i;
+      } else if (std::string(argv[i]) == "-p" && i + 1 < argc) {
+        pipelineConf = argv[++i];
+        lastValueArg = i;
+      } else if (std::string(argv[i]) == "-f" && i + 1 < argc) {
+        filterConf = argv[++i];
+        lastValueArg = i;
+      } else if (std::string(argv[i]) == "-g" && i + 1 < argc) {
+        gateConf = argv[++i];
+        lastValueArg = i;
+      } else if (std::string(argv[i]) == "-c" && i + 1 < argc) {
+        controlFIFO = argv[++i];
+        lastValueArg = i;
       }
     }
 
-    if (std::string(argv[argc - 1]).find('-') == std::string::npos)
+    if (lastValueArg != argc - 1 &&
+        std::string(argv[argc - 1]).find('-') == std::string::npos)
       configList = argv[argc - 1];
   }
 
+  auto stages = LoadPipelineConf(pipelineConf);
+  std::unique_ptr<TEventFilter> filter;
+  if (filterConf != "") {
+    filter = std::make_unique<TEventFilter>();
+    filter->LoadConf(filterConf);
+    auto hasQA = false;
+    for (const auto &stage : stages)
+      hasQA |= std::dynamic_pointer_cast<TWaveformQA>(stage) != nullptr;
+    if (filter->UsesQAFlags() && !hasQA) {
+      std::cerr << "Filter cuts on qaFlags without the WaveformQA stage, "
+                   "qaFlags are always 0"
+                << std::endl;
+    }
+  }
+  std::unique_ptr<TWaveformGate> gate;
+  if (gateConf != "") {
+    gate = std::make_unique<TWaveformGate>();
+    gate->LoadConf(gateConf);
+  }
+
   auto daq = std::make_unique<TDataTaking>();
+  daq->SetProcessingStages(stages);
   if (useTestData == false) {
     daq->LoadConfigFileList(configList);
     daq->OpenDigitizers();
@@ -106,12 +226,22 @@ int main(int argc, char *argv[])
   }
 
   auto monitor = std::make_unique<TDataMonitor>();
+  if (monitorConf != "") monitor->LoadMonitorConf(monitorConf);
+  for (const auto &stage : stages) {
+    auto calibrator = std::dynamic_pointer_cast<TEnergyCalibrator>(stage);
+    if (calibrator) monitor->SetCalibrator(calibrator);
+    auto aligner = std::dynamic_pointer_cast<TClockAligner>(stage);
+    if (aligner) monitor->SetClockAligner(aligner);
+  }
   if (useTestData) {
     std::cout << "Using test data" << std::endl;
+    monitor->SetFirmware(std::vector<std::string>(8, "DPP-PSD"));
     monitor->LoadChannelConf({64, 64, 64, 64, 64, 64, 64, 64});
     monitor->SetDeltaT({2, 2, 2, 2, 2, 2, 2, 2});
   } else {
-    monitor->LoadChannelConf(daq->GetNumberOfCh());
+    monitor->SetFirmware(daq->GetFirmware());
+    monitor->SetPreTrigger(daq->GetPreTrigger());
+    monitor->LoadChannelConf(daq->GetNumberOfCh(), daq->GetModuleID());
     monitor->SetDeltaT(daq->GetDeltaT());
   }
   monitor->StartMonitor();
@@ -120,62 +250,143 @@ int main(int argc, char *argv[])
   recorder->SetFileName("test_data");
   recorder->SetSizeLimit(500 * 1024 * 1024);
   recorder->SetTimeLimit(30);  // minutes
+  recorder->SetWaveformCompression(compressWaveform);
+  recorder->SetRecordProbes(recordProbes);
+  recorder->SetSplitClasses(splitClasses);
   recorder->StartRecording();
 
   if (useTestData == false) {
     daq->StartAcquisition();
   }
+  bool acquiring = true;
 
+  // Commands wake up the data wait below
+  TRunControl control;
+  control.SetNotify([&daq] { daq->Interrupt(); });
+  control.Start(controlFIFO);
+
+  TRACE_THREAD_NAME("Main");
   auto counter = 0UL;
-  auto startTime = std::chrono::high_resolution_clock::now();
-  while (true) {
-    std::unique_ptr<DAQData_t> data;
-    if (useTestData)
-      data = std::move(GetFakeEvents(10000));
-    else
-      data = std::move(daq->GetData());
-
-    if (data->size() > 0) {
-      counter += data->size();
-      auto copyData = std::make_unique<DAQData_t>();
-      for (auto &event : *data) {
-        auto copyEvent = std::make_unique<TEventData>();
-        copyEvent->module = event->module;
-        copyEvent->channel = event->channel;
-        copyEvent->timeStampNs = event->timeStampNs;
-        copyEvent->energy = event->energy;
-        copyEvent->energyShort = event->energyShort;
-        copyEvent->waveformSize = event->waveformSize;
-        copyData->push_back(std::move(copyEvent));
+  std::vector<uint8_t> pass;
+  std::vector<uint8_t> keepTrace;
+  auto dispatch = [&](std::unique_ptr<DAQData_t> data) {
+    if (!data || data->empty()) return;
+    TRACE_SCOPE("Dispatch");
+    counter += data->size();
+    // Only hits passing the filter are copied for the recorder
+    if (filter) filter->Evaluate(*data, pass);
+    // Traces only for hits passing the gate, scalars for all
+    if (gate) gate->Evaluate(*data, keepTrace, filter ? &pass : nullptr);
+    auto copyData = std::make_unique<DAQData_t>();
+    for (auto i = 0U; i < data->size(); i++) {
+      if (filter && !pass[i]) continue;
+      const auto &event = (*data)[i];
+      auto copyEvent = std::make_unique<TEventData>();
+      copyEvent->module = event->module;
+      copyEvent->channel = event->channel;
+      copyEvent->timeStampNs = event->timeStampNs;
+      copyEvent->energy = event->energy;
+      copyEvent->energyShort = event->energyShort;
+      copyEvent->waveformSize = event->waveformSize;
+      if (gate && !keepTrace[i]) copyEvent->waveformSize = 0;
+      if (copyEvent->waveformSize > 0) {
+        if (recordProbes & kRecordAnalogProbe1)
+          copyEvent->analogProbe1 = event->analogProbe1;
+        if (recordProbes & kRecordAnalogProbe2)
+          copyEvent->analogProbe2 = event->analogProbe2;
+        if (recordProbes & kRecordDigitalProbe1)
+          copyEvent->digitalProbe1 = event->digitalProbe1;
+        if (recordProbes & kRecordDigitalProbe2)
+          copyEvent->digitalProbe2 = event->digitalProbe2;
       }
-      monitor->SetData(std::move(data));
-      recorder->SetData(std::move(copyData));
+      copyEvent->readoutTime = event->readoutTime;
+      copyEvent->qaFlags = event->qaFlags;
+      copyEvent->particleClass = event->particleClass;
+      copyEvent->energyCal = event->energyCal;
+      copyData->push_back(std::move(copyEvent));
     }
+    TPipelineStats::GetInstance().RecordBatch(PipelineStage::Dispatch, *data);
+    monitor->SetData(std::move(data));
+    recorder->SetData(std::move(copyData));
+  };
 
-    auto state = InputCheck();
-    if (state == AppState::Quit) {
-      break;
-    } else if (state == AppState::Reload) {
-      std::cout << "Reloading configuration files" << std::endl;
-      monitor->StopMonitor();
-      monitor->ClearHist();
-      if (useTestData == false) {
-        daq->StopAcquisition();
-        daq->ConfigDigitizers();
-        daq->StartAcquisition();
+  auto startTime = std::chrono::high_resolution_clock::now();
+  bool quit = false;
+  while (!quit) {
+    if (useTestData && acquiring) {
+      auto data = GetFakeEvents(10000);
+      for (auto &stage : stages) stage->Process(*data);
+      dispatch(std::move(data));
+    } else {
+      // Sleeps until a batch or a command arrives
+      dispatch(daq->GetData(std::chrono::milliseconds(1000)));
+    }
+
+    RunCommand command;
+    std::string argument;
+    while (control.PopCommand(command, argument)) {
+      if (command == RunCommand::Quit) {
+        quit = true;
+      } else if (command == RunCommand::Reload) {
+        std::cout << "Reloading configuration files" << std::endl;
+        if (useTestData) continue;
+        // Only changed boards stop, the monitor and the others keep running
+        if (argument == "") {
+          auto nReconfigured = daq->ReloadDigitizers();
+          std::cout << nReconfigured << " boards reconfigured" << std::endl;
+        } else {
+          char *end;
+          auto moduleID = std::strtoul(argument.c_str(), &end, 10);
+          if (*end != '\0' || moduleID > 255 ||
+              !daq->ReconfigureDigitizer(moduleID))
+            std::cerr << "No module " << argument << std::endl;
+        }
+      } else if (command == RunCommand::DumpTrace) {
+#ifdef DIGICON_TRACE
+        TTrace::GetInstance().Dump("digicon_trace.json");
+#else
+        std::cout << "Tracing is disabled, rebuild with -DDIGICON_TRACE=ON"
+                  << std::endl;
+#endif
+      } else if (command == RunCommand::StartRun && !acquiring) {
+        std::cout << "Start run" << std::endl;
+        recorder->StartRecording();
+        if (useTestData == false) daq->StartAcquisition();
+        acquiring = true;
+      } else if (command == RunCommand::StopRun && acquiring) {
+        std::cout << "Stop run" << std::endl;
+        if (useTestData == false) {
+          daq->StopAcquisition();
+          dispatch(daq->GetData());  // The last hits
+        }
+        recorder->StopRecording();
+        acquiring = false;
+      } else if (command == RunCommand::FileName) {
+        std::cout << "File name: " << argument << std::endl;
+        recorder->SetFileName(argument);
       }
-      monitor->StartMonitor();
     }
   }
+  control.Stop();
   auto endTime = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       endTime - startTime);
   std::cout << "Total time: " << duration.count() / 1000. << " s" << std::endl;
   std::cout << "Event rate: " << counter / (duration.count() / 1000.) << " Hz"
             << std::endl;
+  if (filter) {
+    std::cout << "Filter accepted " << filter->GetNAccepted() << ", rejected "
+              << filter->GetNRejected() << std::endl;
+  }
+  if (gate) {
+    std::cout << "Traces kept " << gate->GetNKept() << ", dropped "
+              << gate->GetNDropped() << std::endl;
+  }
+  TPipelineStats::GetInstance().Print();
+  TTaskScheduler::GetInstance().Print();
 
   if (useTestData == false) {
-    daq->StopAcquisition();
+    if (acquiring) daq->StopAcquisition();
     daq->CloseDigitizers();
   }
   recorder->StopRecording();
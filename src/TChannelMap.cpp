@@ -0,0 +1,33 @@
+#include "TChannelMap.hpp"
+
+#include <iostream>
+
+TChannelMap::TChannelMap() { fModuleIndex.fill(kNoModule); }
+
+TChannelMap::TChannelMap(const std::vector<uint32_t> &nChs,
+                         const std::vector<uint8_t> &moduleIDs)
+    : fNChs(nChs)
+{
+  fModuleIndex.fill(kNoModule);
+  if (!moduleIDs.empty() && moduleIDs.size() != nChs.size()) {
+    std::cerr << "Number of module IDs and modules differ, using positions"
+              << std::endl;
+  }
+  const auto useIDs = moduleIDs.size() == nChs.size();
+  if (!useIDs && nChs.size() > fModuleIndex.size()) {
+    std::cerr << "More than 256 modules, the rest is ignored" << std::endl;
+    fNChs.resize(fModuleIndex.size());
+  }
+
+  for (auto iMod = 0U; iMod < fNChs.size(); iMod++) {
+    const uint8_t id = useIDs ? moduleIDs[iMod] : iMod;
+    if (fModuleIndex[id] != kNoModule) {
+      std::cerr << "Module ID " << int(id) << " is used twice" << std::endl;
+    } else {
+      fModuleIndex[id] = iMod;
+    }
+    fModuleIDs.push_back(id);
+    fOffset.push_back(fNChannels);
+    fNChannels += fNChs[iMod];
+  }
+}
@@ -0,0 +1,142 @@
+#include "TClockAligner.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+TClockAligner::TClockAligner()
+{
+  for (auto i = 0U; i < kNModules; i++) {
+    fOffset[i] = 0.;
+    fResidual[i] = 0.;
+    fAlarm[i] = false;
+    fNMatched[i] = 0;
+  }
+}
+
+TClockAligner::~TClockAligner() {}
+
+void TClockAligner::LoadConf(const nlohmann::json &conf)
+{
+  // "Offsets": {"module ID": ns}
+  for (auto i = 0U; i < kNModules; i++) {
+    fOffset[i] = 0.;
+    fResidual[i] = 0.;
+    fAlarm[i] = false;
+    fNMatched[i] = 0;
+  }
+  if (conf.contains("Offsets")) {
+    for (auto &mod : conf["Offsets"].items()) {
+      auto id = std::stoi(mod.key());
+      if (id < 0 || id >= int(kNModules)) continue;
+      fOffset[id] = mod.value().get<double>();
+    }
+  }
+
+  // "Reference": {"Channels": [[mod, ch], ...], "Window": ns,
+  // "AlarmThreshold": ns, "Alpha": EMA weight, "AutoCorrect": bool}
+  fReferences.clear();
+  if (conf.contains("Reference")) {
+    auto ref = conf["Reference"];
+    fMatchWindow = ref.value("Window", fMatchWindow);
+    fAlarmThreshold = ref.value("AlarmThreshold", fAlarmThreshold);
+    fAlpha = ref.value("Alpha", fAlpha);
+    fAutoCorrect = ref.value("AutoCorrect", fAutoCorrect);
+    auto channels =
+        ref.value("Channels", std::vector<std::vector<uint32_t>>());
+    for (const auto &ch : channels) {
+      if (ch.size() != 2 || ch[0] >= kNModules || ch[1] > 255) {
+        std::cerr << "Invalid clock reference channel" << std::endl;
+        continue;
+      }
+      fReferences.emplace_back(ch[0], ch[1]);
+    }
+  }
+  fRefTimes.assign(fReferences.size(), std::vector<double>());
+}
+
+double TClockAligner::GetOffset(uint32_t module) const
+{
+  return module < kNModules ? fOffset[module].load() : 0.;
+}
+
+double TClockAligner::GetResidual(uint32_t module) const
+{
+  return module < kNModules ? fResidual[module].load() : 0.;
+}
+
+bool TClockAligner::IsAlarm(uint32_t module) const
+{
+  return module < kNModules ? fAlarm[module].load() : false;
+}
+
+uint64_t TClockAligner::GetNMatched(uint32_t module) const
+{
+  return module < kNModules ? fNMatched[module].load() : 0;
+}
+
+void TClockAligner::Process(DAQData_t &data)
+{
+  std::array<double, kNModules> offset;
+  for (auto i = 0U; i < kNModules; i++) offset[i] = fOffset[i];
+
+  for (auto &times : fRefTimes) times.clear();
+  for (auto &event : data) {
+    event->timeStampNs += offset[event->module];
+    for (auto iRef = 0U; iRef < fReferences.size(); iRef++) {
+      if (event->module == fReferences[iRef].first &&
+          event->channel == fReferences[iRef].second)
+        fRefTimes[iRef].push_back(event->timeStampNs);
+    }
+  }
+
+  if (fReferences.size() > 1) Estimate();
+}
+
+void TClockAligner::Estimate()
+{
+  for (auto &times : fRefTimes) std::sort(times.begin(), times.end());
+  const auto &master = fRefTimes[0];
+
+  for (auto iRef = 1U; iRef < fReferences.size(); iRef++) {
+    const auto module = fReferences[iRef].first;
+    const auto &times = fRefTimes[iRef];
+    if (times.empty()) continue;
+
+    // Mean of (master - module) over the matched pulses of this batch
+    auto sum = 0.;
+    auto nMatched = 0U;
+    for (const auto t : master) {
+      auto it = std::lower_bound(times.begin(), times.end(), t - fMatchWindow);
+      if (it == times.end() || *it > t + fMatchWindow) continue;
+      if (it + 1 != times.end() && std::abs(*(it + 1) - t) < std::abs(*it - t))
+        it++;
+      sum += t - *it;
+      nMatched++;
+    }
+    if (nMatched == 0) continue;
+
+    const auto measured = sum / nMatched;
+    double residual = fResidual[module];
+    residual = fNMatched[module] == 0 ? measured
+                                      : residual + fAlpha * (measured - residual);
+    fNMatched[module] += nMatched;
+
+    if (fAutoCorrect) {
+      fOffset[module] = fOffset[module] + residual;
+      residual = 0.;
+    }
+    fResidual[module] = residual;
+
+    const bool alarm = std::abs(measured) > fAlarmThreshold;
+    if (alarm != fAlarm[module]) {
+      fAlarm[module] = alarm;
+      if (alarm)
+        std::cerr << "Clock alarm: module " << module << " is off by "
+                  << measured << " ns" << std::endl;
+      else
+        std::cout << "Clock of module " << module << " is aligned again"
+                  << std::endl;
+    }
+  }
+}
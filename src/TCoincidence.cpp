@@ -0,0 +1,109 @@
+#include "TCoincidence.hpp"
+
+#include <algorithm>
+
+TCoincidence::TCoincidence(double window, uint32_t nBins)
+    : fWindow(window), fAxis(nBins, -window, window)
+{
+  fInvolved.resize(1 << 16, false);
+}
+
+void TCoincidence::AddPair(uint32_t refMod, uint32_t refCh, uint32_t mod,
+                           uint32_t ch)
+{
+  auto refID = GetID(refMod, refCh);
+  auto id = GetID(mod, ch);
+  if (refID == id) return;
+  for (const auto &pair : fPairs) {
+    if (pair.first == refID && pair.second == id) return;
+  }
+
+  fPairsOfID[id].emplace_back(refID, fPairs.size());
+  fPairs.emplace_back(refID, id);
+  fHists.push_back(std::make_unique<TCompactHist>(fAxis));
+  fInvolved[refID] = true;
+  fInvolved[id] = true;
+}
+
+void TCoincidence::Offer(uint64_t seq, const DAQData_t &data)
+{
+  if (fPairs.empty()) return;
+
+  std::vector<Hit> hits;
+  for (const auto &event : data) {
+    auto id = GetID(event->module, event->channel);
+    if (fInvolved[id]) hits.push_back({event->timeStampNs, id, false});
+  }
+  std::lock_guard<std::mutex> lock(fPendingMutex);
+  fPending[seq] = std::move(hits);
+}
+
+void TCoincidence::ProcessPending()
+{
+  if (fPairs.empty()) return;
+
+  std::lock_guard<std::mutex> lock(fMutex);
+  while (true) {
+    std::vector<Hit> hits;
+    {
+      std::lock_guard<std::mutex> pendingLock(fPendingMutex);
+      auto it = fPending.find(fNextSeq);
+      if (it == fPending.end()) return;
+      hits = std::move(it->second);
+      fPending.erase(it);
+      fNextSeq++;
+    }
+    ProcessHits(hits);
+  }
+}
+
+void TCoincidence::ProcessHits(const std::vector<Hit> &hits)
+{
+  fHits.clear();
+  fHits.insert(fHits.end(), fTail.begin(), fTail.end());
+  fHits.insert(fHits.end(), hits.begin(), hits.end());
+  if (fHits.empty()) return;
+
+  std::sort(fHits.begin(), fHits.end(),
+            [](const Hit &a, const Hit &b) { return a.time < b.time; });
+
+  const auto nHits = static_cast<int64_t>(fHits.size());
+  for (auto i = 0L; i < nHits; i++) {
+    const auto &hit = fHits[i];
+    auto it = fPairsOfID.find(hit.id);
+    if (it == fPairsOfID.end()) continue;
+
+    // Bounded search in both directions
+    auto searchFirst = std::max(0L, i - int64_t(kMaxSearch));
+    auto searchLast = std::min(nHits - 1, i + int64_t(kMaxSearch));
+    for (auto j = searchFirst; j <= searchLast; j++) {
+      if (j == i) continue;
+      const auto &refHit = fHits[j];
+      // Pairs inside the tail were counted with the previous batch
+      if (hit.fromTail && refHit.fromTail) continue;
+      auto dt = hit.time - refHit.time;
+      if (dt <= -fWindow || dt >= fWindow) continue;
+      for (const auto &pair : it->second) {
+        if (pair.first == refHit.id) {
+          auto &hist = fHists[pair.second];
+          hist->AddCell(fAxis.FindBin(dt));
+        }
+      }
+    }
+  }
+
+  // Keep the hits which can still make a pair with the next batch
+  const auto lastTime = fHits.back().time;
+  fTail.clear();
+  for (auto i = nHits - 1; i >= 0 && nHits - i <= kMaxSearch; i--) {
+    if (lastTime - fHits[i].time >= fWindow) break;
+    fTail.push_back({fHits[i].time, fHits[i].id, true});
+  }
+}
+
+void TCoincidence::Reset()
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  for (auto &hist : fHists) hist->Reset();
+  fTail.clear();
+}
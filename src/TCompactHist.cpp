@@ -0,0 +1,110 @@
+#include "TCompactHist.hpp"
+
+TCompactAxis::TCompactAxis(uint32_t nBins, double min, double max)
+    : fNBins(nBins), fMin(min), fMax(max)
+{
+  fScale = static_cast<float>(fNBins / (fMax - fMin));
+}
+
+uint32_t TCompactAxis::FindBin(float x) const
+{
+  auto bin = (x - static_cast<float>(fMin)) * fScale + 1.f;
+  bin = bin < 0.f ? 0.f : bin;
+  bin = bin > fNBins + 1.f ? fNBins + 1.f : bin;
+  return static_cast<uint32_t>(bin);
+}
+
+void TCompactAxis::FindBins(const float *x, uint32_t *bins, uint32_t n) const
+{
+  const auto min = static_cast<float>(fMin);
+  const auto scale = fScale;
+  const auto overflow = fNBins + 1.f;
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    auto bin = (x[i] - min) * scale + 1.f;
+    bin = bin < 0.f ? 0.f : bin;
+    bin = bin > overflow ? overflow : bin;
+    bins[i] = static_cast<uint32_t>(bin);
+  }
+}
+
+TCompactHist::TCompactHist(const TCompactAxis &xAxis)
+    : fXaxis(xAxis), fYaxis(0, 0., 1.)
+{
+  fNCells = fXaxis.GetNBins() + 2;
+  fCounts.reset(new std::atomic<uint32_t>[fNCells]);
+  Reset();
+}
+
+TCompactHist::TCompactHist(const TCompactAxis &xAxis, const TCompactAxis &yAxis)
+    : fXaxis(xAxis), fYaxis(yAxis)
+{
+  fNCells = (fXaxis.GetNBins() + 2) * (fYaxis.GetNBins() + 2);
+  fCounts.reset(new std::atomic<uint32_t>[fNCells]);
+  Reset();
+}
+
+void TCompactHist::GetCells(const TCompactAxis &xAxis, const uint32_t *binsX,
+                            const uint32_t *binsY, uint32_t *cells, uint32_t n)
+{
+  const auto nX = xAxis.GetNBins() + 2;
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    cells[i] = binsX[i] + nX * binsY[i];
+  }
+}
+
+void TCompactHist::CopyTo(TH1 *hist)
+{
+  auto entries = GetEntries();
+  auto subtractions = fSubtractions.load(std::memory_order_relaxed);
+  if (entries == fCopiedEntries && subtractions == fCopiedSubtractions) return;
+  fCopiedEntries = entries;
+  fCopiedSubtractions = subtractions;
+
+  for (auto i = 0U; i < fNCells; i++) {
+    hist->SetBinContent(i, GetCellContent(i));
+  }
+  hist->SetEntries(entries);
+}
+
+void TCompactHist::Reset()
+{
+  for (auto i = 0U; i < fNCells; i++) {
+    fCounts[i].store(0, std::memory_order_relaxed);
+  }
+  fEntries.store(0, std::memory_order_relaxed);
+  fSubtractions.store(0, std::memory_order_relaxed);
+  // Force copying the empty histogram at the next update
+  fCopiedEntries = ~0ULL;
+  fCopiedSubtractions = 0;
+}
+
+TRollingHist::TRollingHist(const TCompactAxis &axis, uint32_t nSlices)
+    : fCurrent(0), fWindow(axis)
+{
+  if (nSlices < 2) nSlices = 2;
+  for (auto i = 0U; i < nSlices; i++) {
+    fSlices.push_back(std::make_unique<TCompactHist>(axis));
+  }
+}
+
+void TRollingHist::Rotate()
+{
+  // The oldest slice is emptied before it becomes the newest one.
+  // Late fills into the previous slice are kept, nothing is lost.
+  auto next = (fCurrent.load(std::memory_order_relaxed) + 1) % fSlices.size();
+  auto &oldest = fSlices[next];
+  for (auto i = 0U; i < oldest->GetNCells(); i++) {
+    auto n = oldest->TakeCell(i);
+    if (n > 0) fWindow.SubtractCell(i, n);
+  }
+  fCurrent.store(next, std::memory_order_relaxed);
+}
+
+void TRollingHist::Reset()
+{
+  for (auto &slice : fSlices) slice->Reset();
+  fWindow.Reset();
+  fCurrent.store(0, std::memory_order_relaxed);
+}
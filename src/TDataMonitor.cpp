@@ -3,15 +3,41 @@
 #include <TROOT.h>
 #include <TSystem.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <nlohmann/json.hpp>
 
-TDataMonitor::TDataMonitor()
+#include "TPipelineStats.hpp"
+#include "TThreadAffinity.hpp"
+#include "TTrace.hpp"
+
+namespace
+{
+// Y bins of the QA histograms
+constexpr uint8_t kQABits[] = {kQAChecked, kQASaturation, kQAPileUp,
+                               kQANoisyBaseline};
+constexpr const char *kQALabels[] = {"Checked", "Saturation", "PileUp",
+                                     "NoisyBaseline"};
+constexpr uint32_t kNQABins = sizeof(kQABits) / sizeof(kQABits[0]);
+}  // namespace
+
+TDataMonitor::TDataMonitor(int port)
 {
   ROOT::EnableThreadSafety();
+  fMonitorRunning = false;
+  fFillQueue = TTaskScheduler::GetInstance().GetQueue("MonitorFill");
+  fCoincidenceQueue =
+      TTaskScheduler::GetInstance().GetQueue("MonitorCoincidence");
 
-  fServer =
-      std::make_unique<THttpServer>("http:8080?monitoring=1000;rw;noglobal");
+  if (port > 0) {
+    fServer = std::make_unique<THttpServer>(
+        Form("http:%d?monitoring=1000;rw;noglobal", port));
+  }
+
+  InitLatencyHist();
 }
 
 TDataMonitor::~TDataMonitor()
@@ -21,10 +47,57 @@ TDataMonitor::~TDataMonitor()
   fServer.reset(nullptr);
 }
 
-void TDataMonitor::LoadChannelConf(const std::vector<uint32_t> &nChs)
+void TDataMonitor::LoadMonitorConf(const std::string &fileName)
+{
+  std::ifstream fin(fileName);
+  if (!fin) {
+    std::cerr << "Monitor configuration " << fileName << " not found"
+              << std::endl;
+    return;
+  }
+  nlohmann::json conf;
+  fin >> conf;
+  fin.close();
+
+  if (conf.contains("RollingWindows")) {
+    fRollingWindows = conf["RollingWindows"].get<std::vector<uint32_t>>();
+  }
+
+  if (conf.contains("NoiseSpectrum")) {
+    auto noise = conf["NoiseSpectrum"];
+    fNoiseSamples = noise.value("Samples", fNoiseSamples);
+    fNoiseDecimation = noise.value("Decimation", fNoiseDecimation);
+  }
+
+  if (conf.contains("Coincidence")) {
+    auto coinc = conf["Coincidence"];
+    if (coinc.contains("Window"))
+      fCoincidenceWindow = coinc["Window"].get<double>();
+    if (coinc.contains("Bins"))
+      fCoincidenceBins = coinc["Bins"].get<uint32_t>();
+    if (coinc.contains("References"))
+      fTimeReferences =
+          coinc["References"].get<std::vector<std::vector<uint32_t>>>();
+    if (coinc.contains("Pairs"))
+      fTimePairs = coinc["Pairs"].get<std::vector<std::vector<uint32_t>>>();
+  }
+}
+
+void TDataMonitor::LoadChannelConf(const std::vector<uint32_t> &nChs,
+                                   const std::vector<uint8_t> &moduleIDs)
 {
-  fModAndCh = nChs;
+  fChannelMap = TChannelMap(nChs, moduleIDs);
+  fGraphMutex = std::make_unique<std::mutex[]>(fChannelMap.GetNChannels());
   InitHist();
+  InitPSDHist();
+  InitQAHist();
+  InitClassHist();
+  InitGainHist();
+  InitClockHist();
+  InitReadoutHist();
+  InitNoiseHist();
+  InitRollingHist();
+  InitTimeDiffHist();
   InitGraph();
   InitCanvas();
   RegisterHistCanvas();
@@ -33,121 +106,549 @@ void TDataMonitor::LoadChannelConf(const std::vector<uint32_t> &nChs)
 void TDataMonitor::InitHist()
 {
   fHist.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TH1D>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
+  fHistData.clear();
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
       auto hist = std::make_unique<TH1D>(
-          Form("hist%02d%02d", iMod, iCh),
-          Form("Module %d Channel %d", iMod, iCh), 30000, 0, 30000);
+          Form("hist%02d%02d", mod, iCh),
+          Form("Module %d Channel %d", mod, iCh), fEnergyAxis.GetNBins(),
+          fEnergyAxis.GetMin(), fEnergyAxis.GetMax());
       hist->SetDirectory(nullptr);
       hist->SetXTitle("ADC");
-      mod.push_back(std::move(hist));
+      fHist.push_back(std::move(hist));
+      fHistData.push_back(std::make_unique<TCompactHist>(fEnergyAxis));
     }
-    fHist.push_back(std::move(mod));
   }
 }
 
-void TDataMonitor::InitGraph()
+void TDataMonitor::InitPSDHist()
+{
+  fPSDHist.clear();
+  fPSDHistData.clear();
+  fPSDRatioHist.clear();
+  fPSDRatioHistData.clear();
+  fUsePSD = false;
+  fPSDHist.resize(fChannelMap.GetNChannels());
+  fPSDHistData.resize(fChannelMap.GetNChannels());
+  fPSDRatioHist.resize(fChannelMap.GetNChannels());
+  fPSDRatioHistData.resize(fChannelMap.GetNChannels());
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    if (iMod < fFirmware.size() && fFirmware[iMod] == "DPP-PSD") {
+      fUsePSD = true;
+      const int mod = fChannelMap.GetModuleID(iMod);
+      for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+        const auto index = fChannelMap.GetOffset(iMod) + iCh;
+        auto hist = std::make_unique<TH2I>(
+            Form("psd%02d%02d", mod, iCh),
+            Form("Module %d Channel %d PSD", mod, iCh),
+            fChargeLongAxis.GetNBins(), fChargeLongAxis.GetMin(),
+            fChargeLongAxis.GetMax(), fChargeShortAxis.GetNBins(),
+            fChargeShortAxis.GetMin(), fChargeShortAxis.GetMax());
+        hist->SetDirectory(nullptr);
+        hist->SetXTitle("ChargeLong");
+        hist->SetYTitle("ChargeShort");
+        fPSDHist[index] = std::move(hist);
+        fPSDHistData[index] =
+            std::make_unique<TCompactHist>(fChargeLongAxis, fChargeShortAxis);
+
+        auto ratio = std::make_unique<TH1D>(
+            Form("psdRatio%02d%02d", mod, iCh),
+            Form("Module %d Channel %d PSD ratio", mod, iCh),
+            fPSDRatioAxis.GetNBins(), fPSDRatioAxis.GetMin(),
+            fPSDRatioAxis.GetMax());
+        ratio->SetDirectory(nullptr);
+        ratio->SetXTitle("(ChargeLong - ChargeShort) / ChargeLong");
+        fPSDRatioHist[index] = std::move(ratio);
+        fPSDRatioHistData[index] =
+            std::make_unique<TCompactHist>(fPSDRatioAxis);
+      }
+    }
+  }
+}
+
+void TDataMonitor::InitQAHist()
+{
+  fQAHist.clear();
+  fQAHistData.clear();
+  const TCompactAxis qaAxis(kNQABins, 0., kNQABins);
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    const auto nChs = fChannelMap.GetNChannels(iMod);
+    const TCompactAxis chAxis(nChs, 0., nChs);
+    auto hist = std::make_unique<TH2I>(
+        Form("qa%02d", mod), Form("Module %d waveform QA", mod),
+        chAxis.GetNBins(), chAxis.GetMin(), chAxis.GetMax(), qaAxis.GetNBins(),
+        qaAxis.GetMin(), qaAxis.GetMax());
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Channel");
+    for (auto i = 0U; i < kNQABins; i++) {
+      hist->GetYaxis()->SetBinLabel(i + 1, kQALabels[i]);
+    }
+    fQAHist.push_back(std::move(hist));
+    fQAHistData.push_back(std::make_unique<TCompactHist>(chAxis, qaAxis));
+  }
+}
+
+void TDataMonitor::InitClassHist()
+{
+  fClassHist.clear();
+  fClassRateHist.clear();
+  fClassHistData.clear();
+  fClassLastCounts.clear();
+  // Unknown is not counted
+  const TCompactAxis classAxis(kNClasses - 1, 1., kNClasses);
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    const auto nChs = fChannelMap.GetNChannels(iMod);
+    const TCompactAxis chAxis(nChs, 0., nChs);
+    auto hist = std::make_unique<TH2I>(
+        Form("class%02d", mod), Form("Module %d particle class", mod),
+        chAxis.GetNBins(), chAxis.GetMin(), chAxis.GetMax(),
+        classAxis.GetNBins(), classAxis.GetMin(), classAxis.GetMax());
+    auto rate = std::make_unique<TH2D>(
+        Form("classRate%02d", mod),
+        Form("Module %d particle class rate [Hz]", mod), chAxis.GetNBins(),
+        chAxis.GetMin(), chAxis.GetMax(), classAxis.GetNBins(),
+        classAxis.GetMin(), classAxis.GetMax());
+    for (auto *h : {static_cast<TH1 *>(hist.get()),
+                    static_cast<TH1 *>(rate.get())}) {
+      h->SetDirectory(nullptr);
+      h->SetXTitle("Channel");
+      for (auto cls = 1U; cls < kNClasses; cls++) {
+        h->GetYaxis()->SetBinLabel(cls, kParticleClassNames[cls]);
+      }
+    }
+    fClassHist.push_back(std::move(hist));
+    fClassRateHist.push_back(std::move(rate));
+    auto data = std::make_unique<TCompactHist>(chAxis, classAxis);
+    fClassLastCounts.emplace_back(data->GetNCells(), 0);
+    fClassHistData.push_back(std::move(data));
+  }
+  fLastClassUpdate = std::chrono::steady_clock::now();
+}
+
+void TDataMonitor::UpdateClassRate()
+{
+  auto now = std::chrono::steady_clock::now();
+  auto dt = std::chrono::duration<double>(now - fLastClassUpdate).count();
+  if (dt <= 0.) return;
+  fLastClassUpdate = now;
+  for (auto iMod = 0U; iMod < fClassHistData.size(); iMod++) {
+    const auto &data = fClassHistData[iMod];
+    auto &last = fClassLastCounts[iMod];
+    for (auto cell = 0U; cell < data->GetNCells(); cell++) {
+      auto count = data->GetCellContent(cell);
+      fClassRateHist[iMod]->SetBinContent(cell, (count - last[cell]) / dt);
+      last[cell] = count;
+    }
+  }
+}
+
+void TDataMonitor::InitGainHist()
+{
+  fGainHist.clear();
+  if (!fCalibrator) return;
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    const auto nChs = fChannelMap.GetNChannels(iMod);
+    auto hist = std::make_unique<TH1D>(Form("gain%02d", mod),
+                                       Form("Module %d relative gain", mod),
+                                       nChs, 0., nChs);
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Channel");
+    hist->SetYTitle("Reference peak / expected");
+    fGainHist.push_back(std::move(hist));
+  }
+}
+
+void TDataMonitor::UpdateGainHist()
+{
+  for (auto iMod = 0U; iMod < fGainHist.size(); iMod++) {
+    const auto mod = fChannelMap.GetModuleID(iMod);
+    for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+      fGainHist[iMod]->SetBinContent(iCh + 1,
+                                     fCalibrator->GetRelativeGain(mod, iCh));
+    }
+  }
+}
+
+void TDataMonitor::InitClockHist()
+{
+  fClockOffsetHist.reset();
+  fClockResidualHist.reset();
+  fClockAlarmHist.reset();
+  if (!fClockAligner) return;
+
+  const auto nMods = static_cast<int>(fChannelMap.GetNModules());
+  fClockOffsetHist = std::make_unique<TH1D>(
+      "clockOffset", "Applied clock offset", nMods, 0., nMods);
+  fClockOffsetHist->SetYTitle("Offset [ns]");
+  fClockResidualHist = std::make_unique<TH1D>(
+      "clockResidual", "Reference time difference to the first module",
+      nMods, 0., nMods);
+  fClockResidualHist->SetYTitle("Residual [ns]");
+  fClockAlarmHist = std::make_unique<TH1D>(
+      "clockAlarm", "Misalignment alarm", nMods, 0., nMods);
+  for (auto *hist : {fClockOffsetHist.get(), fClockResidualHist.get(),
+                     fClockAlarmHist.get()}) {
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Module");
+    SetModuleLabels(hist);
+  }
+}
+
+void TDataMonitor::SetModuleLabels(TH1 *hist) const
+{
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    hist->GetXaxis()->SetBinLabel(iMod + 1,
+                                  Form("%d", fChannelMap.GetModuleID(iMod)));
+  }
+}
+
+void TDataMonitor::InitReadoutHist()
+{
+  const auto nMods = static_cast<int>(fChannelMap.GetNModules());
+  fReadoutEventsHist = std::make_unique<TH1D>(
+      "readoutEvents", "Hits per ReadData call", nMods, 0., nMods);
+  fReadoutTimeoutHist = std::make_unique<TH1D>(
+      "readoutTimeout", "ReadData timeout fraction", nMods, 0., nMods);
+  fReadoutBatchHist = std::make_unique<TH1D>(
+      "readoutBatch", "Hits per readout batch", nMods, 0., nMods);
+  for (auto *hist : {fReadoutEventsHist.get(), fReadoutTimeoutHist.get(),
+                     fReadoutBatchHist.get()}) {
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Module");
+    SetModuleLabels(hist);
+  }
+}
+
+void TDataMonitor::UpdateReadoutHist()
+{
+  auto &stats = TPipelineStats::GetInstance();
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const auto &readout = stats.GetReadout(fChannelMap.GetModuleID(iMod));
+    const double calls = readout.calls;
+    const double batches = readout.batches;
+    if (calls == 0) continue;
+    fReadoutEventsHist->SetBinContent(iMod + 1, readout.events / calls);
+    fReadoutTimeoutHist->SetBinContent(iMod + 1, readout.timeouts / calls);
+    if (batches > 0)
+      fReadoutBatchHist->SetBinContent(iMod + 1, readout.events / batches);
+  }
+}
+
+void TDataMonitor::UpdateClockHist()
 {
-  fGraphAP1.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TGraph>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      auto graph = std::make_unique<TGraph>();
-      graph->SetName(Form("graph%02d%02d", iMod, iCh));
-      graph->SetTitle(Form("Module %d Channel %d", iMod, iCh));
-      graph->SetMaximum(1 << 14);
-      graph->SetMinimum(0);
-      mod.push_back(std::move(graph));
-    }
-    fGraphAP1.push_back(std::move(mod));
-  }
-
-  fGraphAP2.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TGraph>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      auto graph = std::make_unique<TGraph>();
-      graph->SetName(Form("graph%02d%02d", iMod, iCh));
-      graph->SetTitle(Form("Module %d Channel %d", iMod, iCh));
-      graph->SetMaximum(1 << 14);
-      graph->SetMinimum(0);
-      graph->SetLineColor(kRed);
-      graph->SetMarkerColor(kRed);
-      mod.push_back(std::move(graph));
-    }
-    fGraphAP2.push_back(std::move(mod));
-  }
-
-  fGraphDP1.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TGraph>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      auto graph = std::make_unique<TGraph>();
-      graph->SetName(Form("graph%02d%02d", iMod, iCh));
-      graph->SetTitle(Form("Module %d Channel %d", iMod, iCh));
-      graph->SetMaximum(1 << 14);
-      graph->SetMinimum(0);
-      graph->SetLineColor(kGreen);
-      graph->SetMarkerColor(kGreen);
-      mod.push_back(std::move(graph));
-    }
-    fGraphDP1.push_back(std::move(mod));
-  }
-
-  fGraphDP2.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TGraph>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      auto graph = std::make_unique<TGraph>();
-      graph->SetName(Form("graph%02d%02d", iMod, iCh));
-      graph->SetTitle(Form("Module %d Channel %d", iMod, iCh));
-      graph->SetMaximum(1 << 14);
-      graph->SetMinimum(0);
-      graph->SetLineColor(kBlue);
-      graph->SetMarkerColor(kBlue);
-      mod.push_back(std::move(graph));
-    }
-    fGraphDP2.push_back(std::move(mod));
+  if (!fClockAligner) return;
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const auto mod = fChannelMap.GetModuleID(iMod);
+    fClockOffsetHist->SetBinContent(iMod + 1, fClockAligner->GetOffset(mod));
+    fClockResidualHist->SetBinContent(iMod + 1,
+                                      fClockAligner->GetResidual(mod));
+    fClockAlarmHist->SetBinContent(iMod + 1, fClockAligner->IsAlarm(mod));
   }
 }
 
+void TDataMonitor::InitNoiseHist()
+{
+  if (fNoise) fNoise->Stop();
+  fNoise.reset();
+  fNoiseHist.clear();
+  if (fNoiseSamples == 0) return;
+
+  // Samples is the upper limit, the spectrum must fit in the pre-trigger
+  // to stay off the pulse edge
+  auto nSamples = fNoiseSamples;
+  auto maxPreTrigger = 0U;
+  for (auto preTrigger : fPreTrigger)
+    maxPreTrigger = std::max(maxPreTrigger, preTrigger);
+  while (maxPreTrigger > 0 && nSamples > maxPreTrigger) nSamples /= 2;
+  if (nSamples < 2) {
+    std::cerr << "Pre-trigger too short for noise spectra" << std::endl;
+    return;
+  }
+
+  fNoise = std::make_unique<TNoiseSpectrum>(nSamples, fNoiseDecimation,
+                                            fChannelMap, fPreTrigger);
+  const auto nBins = fNoise->GetNBins();
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+      auto hist = std::make_unique<TH1D>(
+          Form("noise%02d%02d", mod, iCh),
+          Form("Module %d Channel %d baseline noise", mod, iCh), nBins, 0.,
+          nBins);
+      hist->SetDirectory(nullptr);
+      hist->SetXTitle("Frequency [MHz]");
+      hist->SetYTitle("Power [ADC^{2}]");
+      fNoiseHist.push_back(std::move(hist));
+    }
+  }
+}
+
+void TDataMonitor::SetNoiseAxis()
+{
+  if (!fNoise) return;
+  const auto nBins = fNoise->GetNBins();
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    if (iMod >= fDeltaT.size() || fDeltaT[iMod] == 0) continue;
+    // Bin k is centred at k / (N dt)
+    const auto binWidth = 1000. / (fDeltaT[iMod] * fNoise->GetNSamples());
+    const auto offset = fChannelMap.GetOffset(iMod);
+    for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+      fNoiseHist[offset + iCh]->GetXaxis()->Set(nBins, -0.5 * binWidth,
+                                                (nBins - 0.5) * binWidth);
+    }
+  }
+}
+
+void TDataMonitor::UpdateNoiseHist()
+{
+  if (!fNoise) return;
+  std::vector<double> power;
+  for (auto index = 0U; index < fNoiseHist.size(); index++) {
+    auto nSpectra = fNoise->GetAverage(index, power);
+    if (nSpectra == 0) continue;
+    auto &hist = fNoiseHist[index];
+    for (auto i = 0U; i < power.size(); i++) {
+      hist->SetBinContent(i + 1, power[i]);
+    }
+    hist->SetEntries(nSpectra);
+  }
+}
+
+void TDataMonitor::InitRollingHist()
+{
+  fRollingHist.clear();
+  fRollingHistData.clear();
+  fLastRotation.clear();
+  for (const auto &window : fRollingWindows) {
+    std::vector<std::unique_ptr<TH1D>> windowHist;
+    std::vector<std::unique_ptr<TRollingHist>> windowData;
+    for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+      const int mod = fChannelMap.GetModuleID(iMod);
+      for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+        auto hist = std::make_unique<TH1D>(
+            Form("hist%02d%02d_%ds", mod, iCh, window),
+            Form("Module %d Channel %d last %d s", mod, iCh, window),
+            fRollingAxis.GetNBins(), fRollingAxis.GetMin(),
+            fRollingAxis.GetMax());
+        hist->SetDirectory(nullptr);
+        hist->SetXTitle("ADC");
+        windowHist.push_back(std::move(hist));
+        windowData.push_back(
+            std::make_unique<TRollingHist>(fRollingAxis, fRollingSlices));
+      }
+    }
+    fRollingHist.push_back(std::move(windowHist));
+    fRollingHistData.push_back(std::move(windowData));
+    fLastRotation.push_back(std::chrono::steady_clock::now());
+  }
+}
+
+void TDataMonitor::RotateRollingHist()
+{
+  auto now = std::chrono::steady_clock::now();
+  for (auto iWindow = 0U; iWindow < fRollingWindows.size(); iWindow++) {
+    auto sliceLength =
+        std::chrono::milliseconds(fRollingWindows[iWindow] * 1000) /
+        fRollingSlices;
+    if (now - fLastRotation[iWindow] < sliceLength) continue;
+    fLastRotation[iWindow] += sliceLength;
+    for (auto &ch : fRollingHistData[iWindow]) ch->Rotate();
+  }
+}
+
+void TDataMonitor::InitTimeDiffHist()
+{
+  fCoincidence =
+      std::make_unique<TCoincidence>(fCoincidenceWindow, fCoincidenceBins);
+  {
+    std::lock_guard<std::mutex> lock(fDataQueueMutex);
+    fNextBatch = 0;
+  }
+  auto inRange = [this](uint32_t mod, uint32_t ch) {
+    return mod < 256 &&
+           fChannelMap.GetIndex(mod, ch) != TChannelMap::kNoChannel;
+  };
+
+  for (const auto &ref : fTimeReferences) {
+    if (ref.size() != 2 || !inRange(ref[0], ref[1])) {
+      std::cerr << "Invalid coincidence reference" << std::endl;
+      continue;
+    }
+    // Reference vs all other channels
+    for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+      const auto mod = fChannelMap.GetModuleID(iMod);
+      for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+        fCoincidence->AddPair(ref[0], ref[1], mod, iCh);
+      }
+    }
+  }
+  for (const auto &pair : fTimePairs) {
+    if (pair.size() != 4 || !inRange(pair[0], pair[1]) ||
+        !inRange(pair[2], pair[3])) {
+      std::cerr << "Invalid coincidence pair" << std::endl;
+      continue;
+    }
+    fCoincidence->AddPair(pair[0], pair[1], pair[2], pair[3]);
+  }
+
+  fTimeDiffHist.clear();
+  for (auto i = 0U; i < fCoincidence->GetNPairs(); i++) {
+    auto pair = fCoincidence->GetPair(i);
+    auto refMod = pair.first >> 8;
+    auto refCh = pair.first & 0xFF;
+    auto mod = pair.second >> 8;
+    auto ch = pair.second & 0xFF;
+    auto hist = std::make_unique<TH1D>(
+        Form("dt%02d%02d_%02d%02d", refMod, refCh, mod, ch),
+        Form("Module %d Channel %d - Module %d Channel %d", mod, ch, refMod,
+             refCh),
+        fCoincidenceBins, -fCoincidenceWindow, fCoincidenceWindow);
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Time difference [ns]");
+    fTimeDiffHist.push_back(std::move(hist));
+  }
+}
+
+void TDataMonitor::UpdateHist()
+{
+  for (auto index = 0U; index < fChannelMap.GetNChannels(); index++) {
+    fHistData[index]->CopyTo(fHist[index].get());
+    if (fPSDHist[index]) {
+      fPSDHistData[index]->CopyTo(fPSDHist[index].get());
+      fPSDRatioHistData[index]->CopyTo(fPSDRatioHist[index].get());
+    }
+  }
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    fQAHistData[iMod]->CopyTo(fQAHist[iMod].get());
+    fClassHistData[iMod]->CopyTo(fClassHist[iMod].get());
+  }
+
+  for (auto iWindow = 0U; iWindow < fRollingWindows.size(); iWindow++) {
+    for (auto index = 0U; index < fChannelMap.GetNChannels(); index++) {
+      fRollingHistData[iWindow][index]->GetWindow().CopyTo(
+          fRollingHist[iWindow][index].get());
+    }
+  }
+
+  for (auto i = 0U; i < fTimeDiffHist.size(); i++) {
+    fCoincidence->GetHist(i).CopyTo(fTimeDiffHist[i].get());
+  }
+
+  UpdateClassRate();
+  UpdateGainHist();
+  UpdateClockHist();
+  UpdateReadoutHist();
+  UpdateNoiseHist();
+}
+
+void TDataMonitor::InitGraph()
+{
+  auto initGraph = [this](std::vector<std::unique_ptr<TGraph>> &graphs,
+                          Color_t color) {
+    graphs.clear();
+    for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+      const int mod = fChannelMap.GetModuleID(iMod);
+      for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
+        auto graph = std::make_unique<TGraph>();
+        graph->SetName(Form("graph%02d%02d", mod, iCh));
+        graph->SetTitle(Form("Module %d Channel %d", mod, iCh));
+        graph->SetMaximum(1 << 14);
+        graph->SetMinimum(0);
+        graph->SetLineColor(color);
+        graph->SetMarkerColor(color);
+        graphs.push_back(std::move(graph));
+      }
+    }
+  };
+  initGraph(fGraphAP1, kBlack);
+  initGraph(fGraphAP2, kRed);
+  initGraph(fGraphDP1, kGreen);
+  initGraph(fGraphDP2, kBlue);
+}
+
 void TDataMonitor::InitCanvas()
 {
   fCanvas.clear();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    std::vector<std::unique_ptr<TCanvas>> mod;
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    for (auto iCh = 0U; iCh < fChannelMap.GetNChannels(iMod); iCh++) {
       auto canvas = std::make_unique<TCanvas>(
-          Form("canvas%02d%02d", iMod, iCh),
-          Form("Module %d Channel %d", iMod, iCh), 800, 600);
-      mod.push_back(std::move(canvas));
+          Form("canvas%02d%02d", mod, iCh),
+          Form("Module %d Channel %d", mod, iCh), 800, 600);
+      fCanvas.push_back(std::move(canvas));
     }
-    fCanvas.push_back(std::move(mod));
   }
 }
 
 void TDataMonitor::RegisterHistCanvas()
 {
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      fCanvas[iMod][iCh]->cd();
-      fGraphAP1[iMod][iCh]->Draw("AL");
-      fGraphAP2[iMod][iCh]->Draw("SAME");
-      fGraphDP1[iMod][iCh]->Draw("SAME");
-      fGraphDP2[iMod][iCh]->Draw("SAME");
-      fCanvas[iMod][iCh]->SetGridx();
-      fCanvas[iMod][iCh]->SetGridy();
-    }
+  for (auto index = 0U; index < fChannelMap.GetNChannels(); index++) {
+    fCanvas[index]->cd();
+    fGraphAP1[index]->Draw("AL");
+    fGraphAP2[index]->Draw("SAME");
+    fGraphDP1[index]->Draw("SAME");
+    fGraphDP2[index]->Draw("SAME");
+    fCanvas[index]->SetGridx();
+    fCanvas[index]->SetGridy();
   }
 
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    auto location = Form("/Module%02d", iMod);
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      fServer->Register(location, fHist[iMod][iCh].get());
-      fServer->Register(location, fCanvas[iMod][iCh].get());
+  if (!fServer) return;
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    const int mod = fChannelMap.GetModuleID(iMod);
+    const auto first = fChannelMap.GetOffset(iMod);
+    const auto last = first + fChannelMap.GetNChannels(iMod);
+    auto location = Form("/Module%02d", mod);
+    for (auto index = first; index < last; index++) {
+      fServer->Register(location, fHist[index].get());
+      fServer->Register(location, fCanvas[index].get());
+    }
+
+    auto psdLocation = Form("/Module%02d/PSD", mod);
+    for (auto index = first; index < last; index++) {
+      if (!fPSDHist[index]) continue;
+      fServer->Register(psdLocation, fPSDHist[index].get());
+      fServer->Register(psdLocation, fPSDRatioHist[index].get());
+    }
+
+    fServer->Register(Form("/Module%02d/QA", mod), fQAHist[iMod].get());
+    auto classLocation = Form("/Module%02d/Class", mod);
+    fServer->Register(classLocation, fClassHist[iMod].get());
+    fServer->Register(classLocation, fClassRateHist[iMod].get());
+    if (iMod < fGainHist.size())
+      fServer->Register(Form("/Module%02d/Gain", mod), fGainHist[iMod].get());
+    if (!fNoiseHist.empty()) {
+      auto noiseLocation = Form("/Module%02d/Noise", mod);
+      for (auto index = first; index < last; index++) {
+        fServer->Register(noiseLocation, fNoiseHist[index].get());
+      }
+    }
+
+    for (auto iWindow = 0U; iWindow < fRollingWindows.size(); iWindow++) {
+      auto rollingLocation =
+          Form("/Module%02d/Last%ds", mod, fRollingWindows[iWindow]);
+      for (auto index = first; index < last; index++) {
+        fServer->Register(rollingLocation, fRollingHist[iWindow][index].get());
+      }
     }
   }
+
+  for (auto &hist : fTimeDiffHist) {
+    fServer->Register("/Coincidence", hist.get());
+  }
+
+  fServer->Register("/Readout", fReadoutEventsHist.get());
+  fServer->Register("/Readout", fReadoutTimeoutHist.get());
+  fServer->Register("/Readout", fReadoutBatchHist.get());
+
+  if (fClockAligner) {
+    fServer->Register("/Clock", fClockOffsetHist.get());
+    fServer->Register("/Clock", fClockResidualHist.get());
+    fServer->Register("/Clock", fClockAlarmHist.get());
+  }
 }
 
 void TDataMonitor::SetData(std::unique_ptr<DAQData_t> data)
@@ -156,132 +657,308 @@ void TDataMonitor::SetData(std::unique_ptr<DAQData_t> data)
     std::lock_guard<std::mutex> lock(fDataQueueMutex);
     fDataQueue.push_back(std::move(data));
   }
+  if (fMonitorRunning) {
+    TTaskScheduler::GetInstance().Submit(fFillQueue, [this] { FillBatch(); });
+  }
 }
 
-void TDataMonitor::FillingThread()
+void TDataMonitor::FillBatch()
 {
-  ROOT::EnableThreadSafety();
-
   std::unique_ptr<DAQData_t> localData = nullptr;
-  auto counter = 0;
+  uint64_t seq;
+  {
+    std::lock_guard<std::mutex> lock(fDataQueueMutex);
+    if (fDataQueue.empty()) return;
+    localData = std::move(fDataQueue.front());
+    fDataQueue.pop_front();
+    seq = fNextBatch++;
+  }
+  FillData(*localData, seq, true);
+}
 
-  while (fMonitorRunning) {
-    {
-      std::lock_guard<std::mutex> lock(fDataQueueMutex);
-      if (!fDataQueue.empty()) {
-        localData = std::move(fDataQueue.front());
-        fDataQueue.pop_front();
-        counter++;
+void TDataMonitor::FillBatch(std::unique_ptr<DAQData_t> data)
+{
+  uint64_t seq;
+  {
+    std::lock_guard<std::mutex> lock(fDataQueueMutex);
+    seq = fNextBatch++;
+  }
+  FillData(*data, seq, false);
+}
+
+void TDataMonitor::FillData(const DAQData_t &data, uint64_t seq,
+                            bool whileRunning)
+{
+  // Columns of the batch, reused for every batch of the worker thread
+  thread_local std::vector<float> energy;
+  thread_local std::vector<float> energyShort;
+  thread_local std::vector<float> psdRatio;
+  thread_local std::vector<uint32_t> energyBins;
+  thread_local std::vector<uint32_t> rollingBins;
+  thread_local std::vector<uint32_t> longBins;
+  thread_local std::vector<uint32_t> shortBins;
+  thread_local std::vector<uint32_t> psdCells;
+  thread_local std::vector<uint32_t> psdRatioBins;
+  thread_local std::vector<uint32_t> channelIndex;
+  thread_local std::vector<uint8_t> drawFlag;
+
+  TRACE_SCOPE("FillBatch");
+  const auto nEvents = static_cast<uint32_t>(data.size());
+  energy.resize(nEvents);
+  energyShort.resize(nEvents);
+  energyBins.resize(nEvents);
+  channelIndex.resize(nEvents);
+  for (auto i = 0U; i < nEvents; i++) {
+    const auto &event = data[i];
+    energy[i] = event->energy;
+    energyShort[i] = event->energyShort;
+    channelIndex[i] = fChannelMap.GetIndex(event->module, event->channel);
+  }
+
+  // Bins of the whole batch at once, then only counters are incremented
+  fEnergyAxis.FindBins(energy.data(), energyBins.data(), nEvents);
+  if (!fRollingWindows.empty()) {
+    rollingBins.resize(nEvents);
+    fRollingAxis.FindBins(energy.data(), rollingBins.data(), nEvents);
+  }
+  if (fUsePSD) {
+    psdRatio.resize(nEvents);
+    longBins.resize(nEvents);
+    shortBins.resize(nEvents);
+    psdCells.resize(nEvents);
+    psdRatioBins.resize(nEvents);
+#pragma omp simd
+    for (auto i = 0U; i < nEvents; i++) {
+      psdRatio[i] = PSDRatio(energy[i], energyShort[i]);
+    }
+    fChargeLongAxis.FindBins(energy.data(), longBins.data(), nEvents);
+    fChargeShortAxis.FindBins(energyShort.data(), shortBins.data(),
+                              nEvents);
+    TCompactHist::GetCells(fChargeLongAxis, longBins.data(),
+                           shortBins.data(), psdCells.data(), nEvents);
+    fPSDRatioAxis.FindBins(psdRatio.data(), psdRatioBins.data(), nEvents);
+  }
+
+  for (auto i = 0U; i < nEvents; i++) {
+    const auto index = channelIndex[i];
+    if (index == TChannelMap::kNoChannel) continue;
+    const auto &event = data[i];
+
+    fHistData[index]->AddCell(energyBins[i]);
+    for (auto &window : fRollingHistData) {
+      window[index]->AddCell(rollingBins[i]);
+    }
+    if (fPSDHistData[index]) {
+      fPSDHistData[index]->AddCell(psdCells[i]);
+      fPSDRatioHistData[index]->AddCell(psdRatioBins[i]);
+    }
+    const auto isChecked = event->qaFlags & kQAChecked;
+    const auto isClassified = event->particleClass != kClassUnknown &&
+                              event->particleClass < kNClasses;
+    if (!isChecked && !isClassified) continue;
+    const auto iMod = fChannelMap.GetModuleIndex(event->module);
+    const auto ch = event->channel;
+    const auto nCellsX = fChannelMap.GetNChannels(iMod) + 2;
+    if (isChecked) {
+      for (auto iBit = 0U; iBit < kNQABins; iBit++) {
+        if (event->qaFlags & kQABits[iBit])
+          fQAHistData[iMod]->AddCell((ch + 1) + nCellsX * (iBit + 1));
       }
     }
+    if (isClassified) {
+      fClassHistData[iMod]->AddCell((ch + 1) +
+                                    nCellsX * event->particleClass);
+    }
+  }
 
-    if (localData) {
-      std::vector<std::vector<bool>> drawFlag(fNMods,
-                                              std::vector<bool>(fNChs, false));
-      for (const auto &event : *localData) {
-        if (fMonitorRunning == false) break;
-        auto mod = event->module;
-        auto ch = event->channel;
-        if (mod >= fModAndCh.size() || ch >= fModAndCh[mod]) continue;
-
-        fHist[mod][ch]->Fill(event->energy);
-
-        if (event->waveformSize > 0) {
-          if (drawFlag[mod][ch] == false) {
-            drawFlag[mod][ch] = true;
-            {
-              std::lock_guard<std::mutex> lock(fAP1Mutex[mod][ch]);
-              if (fGraphAP1[mod][ch]->GetN() == 0) {
-                fGraphAP1[mod][ch]->Set(event->waveformSize);
-              }
-              auto *xAP1 = fGraphAP1[mod][ch]->GetX();
-              auto *yAP1 = fGraphAP1[mod][ch]->GetY();
-              for (auto i = 0U; i < event->waveformSize; i++) {
-                xAP1[i] = i * fDeltaT[mod];
-                yAP1[i] = event->analogProbe1[i];
-              }
-            }
-            {
-              std::lock_guard<std::mutex> lock(fAP2Mutex[mod][ch]);
-              if (fGraphAP2[mod][ch]->GetN() == 0) {
-                fGraphAP2[mod][ch]->Set(event->waveformSize);
-              }
-              auto *xAP2 = fGraphAP2[mod][ch]->GetX();
-              auto *yAP2 = fGraphAP2[mod][ch]->GetY();
-              for (auto i = 0U; i < event->waveformSize; i++) {
-                xAP2[i] = i * fDeltaT[mod];
-                yAP2[i] = event->analogProbe2[i];
-              }
-            }
-            {
-              std::lock_guard<std::mutex> lock(fDP1Mutex[mod][ch]);
-              if (fGraphDP1[mod][ch]->GetN() == 0) {
-                fGraphDP1[mod][ch]->Set(event->waveformSize);
-              }
-              auto *xDP1 = fGraphDP1[mod][ch]->GetX();
-              auto *yDP1 = fGraphDP1[mod][ch]->GetY();
-              for (auto i = 0U; i < event->waveformSize; i++) {
-                xDP1[i] = i * fDeltaT[mod];
-                yDP1[i] = event->digitalProbe1[i] * ((1 << 14) - 1000);
-              }
-            }
-            {
-              std::lock_guard<std::mutex> lock(fDP2Mutex[mod][ch]);
-              if (fGraphDP2[mod][ch]->GetN() == 0) {
-                fGraphDP2[mod][ch]->Set(event->waveformSize);
-              }
-              auto *xDP2 = fGraphDP2[mod][ch]->GetX();
-              auto *yDP2 = fGraphDP2[mod][ch]->GetY();
-              for (auto i = 0U; i < event->waveformSize; i++) {
-                xDP2[i] = i * fDeltaT[mod];
-                yDP2[i] = event->digitalProbe2[i] * ((1 << 14) - 1500);
-              }
-            }
-          }
-        }
+  if (fCoincidence->GetNPairs() > 0) {
+    fCoincidence->Offer(seq, data);
+    TTaskScheduler::GetInstance().Submit(
+        fCoincidenceQueue, [this] { fCoincidence->ProcessPending(); });
+  }
+
+  // The first trace of each channel in the batch is drawn
+  drawFlag.assign(fChannelMap.GetNChannels(), 0);
+  for (auto iEvent = 0U; iEvent < nEvents; iEvent++) {
+    if (whileRunning && fMonitorRunning == false) break;
+    const auto index = channelIndex[iEvent];
+    if (index == TChannelMap::kNoChannel) continue;
+    const auto &event = data[iEvent];
+
+    if (event->waveformSize > 0) {
+      if (fNoise) {
+        fNoise->Offer(
+            index, event->analogProbe1.data(),
+            std::min(event->waveformSize, event->analogProbe1.size()));
       }
+      if (drawFlag[index]) continue;
+      drawFlag[index] = 1;
 
-      localData.reset();
-    } else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      const auto deltaT = fDeltaT[fChannelMap.GetModuleIndex(event->module)];
+      std::lock_guard<std::mutex> lock(fGraphMutex[index]);
+      auto &graphAP1 = fGraphAP1[index];
+      auto &graphAP2 = fGraphAP2[index];
+      auto &graphDP1 = fGraphDP1[index];
+      auto &graphDP2 = fGraphDP2[index];
+      if (graphAP1->GetN() == 0) {
+        for (auto &graph : {graphAP1.get(), graphAP2.get(), graphDP1.get(),
+                            graphDP2.get()}) {
+          graph->Set(event->waveformSize);
+        }
+      }
+      auto *xAP1 = graphAP1->GetX();
+      auto *yAP1 = graphAP1->GetY();
+      auto *xAP2 = graphAP2->GetX();
+      auto *yAP2 = graphAP2->GetY();
+      auto *xDP1 = graphDP1->GetX();
+      auto *yDP1 = graphDP1->GetY();
+      auto *xDP2 = graphDP2->GetX();
+      auto *yDP2 = graphDP2->GetY();
+      for (auto i = 0U; i < event->waveformSize; i++) {
+        xAP1[i] = xAP2[i] = xDP1[i] = xDP2[i] = i * deltaT;
+        yAP1[i] = event->analogProbe1[i];
+        yAP2[i] = event->analogProbe2[i];
+        yDP1[i] =
+            GetDigitalProbe(event->digitalProbe1, i) * ((1 << 14) - 1000);
+        yDP2[i] =
+            GetDigitalProbe(event->digitalProbe2, i) * ((1 << 14) - 1500);
+      }
     }
   }
+
+  TPipelineStats::GetInstance().RecordBatch(PipelineStage::MonitorFill,
+                                            data);
 }
 
 void TDataMonitor::ROOTThread()
 {
   ROOT::EnableThreadSafety();
+  auto lastUpdate = std::chrono::steady_clock::now();
+  TRACE_THREAD_NAME("ROOTThread");
+  TThreadAffinity::GetInstance().Apply("Monitor");
   while (fMonitorRunning) {
-    gSystem->ProcessEvents();
+    RotateRollingHist();
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastUpdate > std::chrono::seconds(1)) {
+      TRACE_SCOPE("UpdateHist");
+      UpdateHist();
+      UpdateLatencyHist();
+      lastUpdate = now;
+    }
+    {
+      TRACE_SCOPE("ProcessEvents");
+      gSystem->ProcessEvents();
+    }
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 }
 
+void TDataMonitor::InitLatencyHist()
+{
+  // Log binning from 1 us to 100 s, 10 bins per decade
+  constexpr auto nDecades = 8;
+  constexpr auto binsPerDecade = 10;
+  constexpr auto nBins = nDecades * binsPerDecade;
+  std::vector<double> edges(nBins + 1);
+  for (auto i = 0; i <= nBins; i++) {
+    edges[i] = 1.e-3 * std::pow(10., double(i) / binsPerDecade);  // in ms
+  }
+
+  fLatencyHist.clear();
+  constexpr auto nStages = static_cast<uint32_t>(PipelineStage::NStages);
+  for (auto i = 0U; i < nStages; i++) {
+    auto name = TPipelineStats::GetStageName(static_cast<PipelineStage>(i));
+    auto hist = std::make_unique<TH1D>(Form("latency%s", name),
+                                       Form("%s latency", name), nBins,
+                                       edges.data());
+    hist->SetDirectory(nullptr);
+    hist->SetXTitle("Latency from readout [ms]");
+    if (fServer) fServer->Register("/Latency", hist.get());
+    fLatencyHist.push_back(std::move(hist));
+  }
+}
+
+void TDataMonitor::UpdateLatencyHist()
+{
+  auto &stats = TPipelineStats::GetInstance();
+  for (auto i = 0U; i < fLatencyHist.size(); i++) {
+    auto stage = static_cast<PipelineStage>(i);
+    const auto &latency = stats.GetLatency(stage);
+    auto &hist = fLatencyHist[i];
+    hist->Reset("ICESM");
+    for (auto iBucket = 0U; iBucket < TLatencyHistogram::kNBuckets;
+         iBucket++) {
+      auto count = latency.GetBucketCount(iBucket);
+      if (count == 0) continue;
+      hist->Fill(TLatencyHistogram::GetBucketLowEdge(iBucket) * 1.e-6, count);
+    }
+    hist->SetTitle(Form("%s latency: p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+                        TPipelineStats::GetStageName(stage),
+                        latency.GetPercentile(50.) * 1.e-6,
+                        latency.GetPercentile(99.) * 1.e-6,
+                        latency.GetMax() * 1.e-6));
+  }
+}
+
 void TDataMonitor::StartMonitor()
 {
   fMonitorRunning = true;
-  constexpr uint32_t nThreads = 16;
-  fThreadPool.push_back(std::thread(&TDataMonitor::ROOTThread, this));
-  for (auto i = 0U; i < nThreads; i++) {
-    fThreadPool.push_back(std::thread(&TDataMonitor::FillingThread, this));
+  SetNoiseAxis();
+  if (fNoise) fNoise->Start();
+  fROOTThread = std::thread(&TDataMonitor::ROOTThread, this);
+
+  // Batches queued while stopped
+  std::size_t nQueued;
+  {
+    std::lock_guard<std::mutex> lock(fDataQueueMutex);
+    nQueued = fDataQueue.size();
+  }
+  for (auto i = 0U; i < nQueued; i++) {
+    TTaskScheduler::GetInstance().Submit(fFillQueue, [this] { FillBatch(); });
   }
 }
 
 void TDataMonitor::StopMonitor()
 {
   fMonitorRunning = false;
-  for (auto &thread : fThreadPool) {
-    thread.join();
-  }
-  fThreadPool.clear();
+  TTaskScheduler::GetInstance().Wait(fFillQueue);
+  TTaskScheduler::GetInstance().Wait(fCoincidenceQueue);
+  if (fROOTThread.joinable()) fROOTThread.join();
+  if (fNoise) fNoise->Stop();
 }
 
 void TDataMonitor::ClearHist()
 {
   ROOT::EnableThreadSafety();
-  for (auto iMod = 0U; iMod < fModAndCh.size(); iMod++) {
-    for (auto iCh = 0U; iCh < fModAndCh[iMod]; iCh++) {
-      fHist[iMod][iCh]->Reset("ICESM");
+  for (auto index = 0U; index < fChannelMap.GetNChannels(); index++) {
+    fHist[index]->Reset("ICESM");
+    fHistData[index]->Reset();
+    if (fPSDHist[index]) {
+      fPSDHist[index]->Reset("ICESM");
+      fPSDHistData[index]->Reset();
+      fPSDRatioHist[index]->Reset("ICESM");
+      fPSDRatioHistData[index]->Reset();
+    }
+  }
+  for (auto iMod = 0U; iMod < fChannelMap.GetNModules(); iMod++) {
+    fQAHist[iMod]->Reset("ICESM");
+    fQAHistData[iMod]->Reset();
+    fClassHist[iMod]->Reset("ICESM");
+    fClassRateHist[iMod]->Reset("ICESM");
+    fClassHistData[iMod]->Reset();
+    std::fill(fClassLastCounts[iMod].begin(), fClassLastCounts[iMod].end(), 0);
+  }
+  for (auto &hist : fNoiseHist) hist->Reset("ICESM");
+  if (fNoise) fNoise->Reset();
+
+  for (auto iWindow = 0U; iWindow < fRollingWindows.size(); iWindow++) {
+    for (auto index = 0U; index < fChannelMap.GetNChannels(); index++) {
+      fRollingHist[iWindow][index]->Reset("ICESM");
+      fRollingHistData[iWindow][index]->Reset();
     }
+    fLastRotation[iWindow] = std::chrono::steady_clock::now();
   }
+
+  fCoincidence->Reset();
+  for (auto &hist : fTimeDiffHist) hist->Reset("ICESM");
 }
\ No newline at end of file
@@ -5,10 +5,22 @@
 #include <TTree.h>
 
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <parallel/algorithm>
 
-TDataRecorder::TDataRecorder() { fRecording = false; }
+#include "TPipelineStats.hpp"
+#include "TTaskScheduler.hpp"
+#include "TTrace.hpp"
+#include "TWaveformCodec.hpp"
+
+TDataRecorder::TDataRecorder()
+{
+  fRecording = false;
+  auto &scheduler = TTaskScheduler::GetInstance();
+  fConvertQueue = scheduler.GetQueue("Conversion");
+  fWriteQueue = scheduler.GetQueue("Writing");
+}
 
 TDataRecorder::~TDataRecorder() { StopRecording(); }
 
@@ -18,6 +30,121 @@ void TDataRecorder::SetData(std::unique_ptr<DAQData_t> data)
     std::lock_guard<std::mutex> lock(fRawDataQueMutex);
     fRawDataQue.push_back(std::move(data));
   }
+  // One task per batch, it takes the oldest batch of the queue
+  if (fRecording) {
+    TTaskScheduler::GetInstance().Submit(fConvertQueue,
+                                         [this] { ConvertBatch(); });
+  }
+}
+
+void TDataRecorder::ConvertEvent(const TEventData &event,
+                                 TSmallEventData &smallEvent) const
+{
+  smallEvent.module = event.module;
+  smallEvent.channel = event.channel;
+  smallEvent.timeStampNs = event.timeStampNs;
+  smallEvent.energy = event.energy;
+  smallEvent.energyShort = event.energyShort;
+  smallEvent.readoutTime = event.readoutTime;
+  smallEvent.qaFlags = event.qaFlags;
+  smallEvent.particleClass = event.particleClass;
+  smallEvent.energyCal = event.energyCal;
+  smallEvent.waveform.clear();
+  smallEvent.signalCodec.clear();
+  smallEvent.analogProbe2.clear();
+  smallEvent.analogProbe2Codec.clear();
+  smallEvent.digitalProbe1.clear();
+  smallEvent.digitalProbe2.clear();
+  if (event.waveformSize == 0) return;
+
+  auto copyAnalog = [this, &event](const std::vector<int16_t> &probe,
+                                   std::vector<int16_t> &raw,
+                                   std::vector<uint8_t> &codec) {
+    const auto size = std::min(event.waveformSize, probe.size());
+    if (size == 0) return;
+    if (fCompressWaveform)
+      TWaveformCodec::Encode(probe.data(), size, codec);
+    else
+      raw.assign(probe.begin(), probe.begin() + size);
+  };
+  auto copyDigital = [&event](const std::vector<uint64_t> &probe,
+                              std::vector<uint64_t> &packed) {
+    const auto nWords =
+        std::min(DigitalProbeWords(event.waveformSize), probe.size());
+    packed.assign(probe.begin(), probe.begin() + nWords);
+  };
+
+  if (fRecordProbes & kRecordAnalogProbe1)
+    copyAnalog(event.analogProbe1, smallEvent.waveform, smallEvent.signalCodec);
+  if (fRecordProbes & kRecordAnalogProbe2)
+    copyAnalog(event.analogProbe2, smallEvent.analogProbe2,
+               smallEvent.analogProbe2Codec);
+  if (fRecordProbes & kRecordDigitalProbe1)
+    copyDigital(event.digitalProbe1, smallEvent.digitalProbe1);
+  if (fRecordProbes & kRecordDigitalProbe2)
+    copyDigital(event.digitalProbe2, smallEvent.digitalProbe2);
+}
+
+uint32_t TDataRecorder::GetTraceSize(const TSmallEventData &event)
+{
+  // Probes not recorded are empty
+  constexpr auto analogSize = sizeof(int16_t);
+  constexpr auto digitalSize = sizeof(uint64_t);
+  return (event.waveform.size() + event.analogProbe2.size()) * analogSize +
+         event.signalCodec.size() + event.analogProbe2Codec.size() +
+         (event.digitalProbe1.size() + event.digitalProbe2.size()) *
+             digitalSize;
+}
+
+void TDataRecorder::CreateBranches(TTree *tree, TSmallEventData &event) const
+{
+  tree->Branch("Mod", &event.module, "Mod/b");
+  tree->Branch("Ch", &event.channel, "Ch/b");
+  tree->Branch("FineTS", &event.timeStampNs, "FineTS/D");
+  tree->Branch("ChargeLong", &event.energy, "ChargeLong/s");
+  tree->Branch("ChargeShort", &event.energyShort, "ChargeShort/S");
+  tree->Branch("QAFlags", &event.qaFlags, "QAFlags/b");
+  tree->Branch("Class", &event.particleClass, "Class/b");
+  tree->Branch("EnergyCal", &event.energyCal, "EnergyCal/F");
+  if (fRecordProbes & kRecordAnalogProbe1) {
+    if (fCompressWaveform)
+      tree->Branch("SignalCodec", &event.signalCodec);
+    else
+      tree->Branch("Signal", &event.waveform);
+  }
+  if (fRecordProbes & kRecordAnalogProbe2) {
+    if (fCompressWaveform)
+      tree->Branch("AnalogProbe2Codec", &event.analogProbe2Codec);
+    else
+      tree->Branch("AnalogProbe2", &event.analogProbe2);
+  }
+  if (fRecordProbes & kRecordDigitalProbe1)
+    tree->Branch("DigitalProbe1", &event.digitalProbe1);
+  if (fRecordProbes & kRecordDigitalProbe2)
+    tree->Branch("DigitalProbe2", &event.digitalProbe2);
+}
+
+std::vector<TTree *> TDataRecorder::CreateTrees(TSmallEventData &event) const
+{
+  std::vector<TTree *> trees;
+  if (fSplitClasses) {
+    for (auto cls = 0U; cls < kNClasses; cls++) {
+      auto name = std::string("data_") + kParticleClassNames[cls];
+      trees.push_back(new TTree(name.c_str(), name.c_str()));
+    }
+  } else {
+    trees.push_back(new TTree("data", "data"));
+  }
+  for (auto tree : trees) CreateBranches(tree, event);
+  return trees;
+}
+
+TTree *TDataRecorder::SelectTree(const std::vector<TTree *> &trees,
+                                 const TSmallEventData &event) const
+{
+  if (fSplitClasses && event.particleClass < trees.size())
+    return trees[event.particleClass];
+  return trees[0];
 }
 
 void TDataRecorder::SetSizeLimit(const uint32_t &maxSize)
@@ -32,189 +159,208 @@ void TDataRecorder::SetTimeLimit(const uint32_t &minutes)
 
 void TDataRecorder::SetFileName(const std::string &fileName)
 {
+  // Used by the next file, also while recording
+  std::lock_guard<std::mutex> lock(fFileMutex);
+  if (fileName != fFileName) fFileVersion = 0;
   fFileName = fileName;
 }
 
-void TDataRecorder::ConvertingThread()
+std::string TDataRecorder::NextFileName()
 {
-  std::unique_ptr<DAQData_t> localData = nullptr;
+  // The version continues over stop and start, and existing files (e.g. of
+  // an earlier session) are skipped, RECREATE would overwrite them
+  std::string fileName;
+  do {
+    fileName = fFileName + "_" + std::to_string(fFileVersion++) + ".root";
+  } while (std::filesystem::exists(fileName));
+  return fileName;
+}
 
+uint32_t TDataRecorder::ConvertData(
+    const DAQData_t &data, std::vector<TSmallEventData *> &dataVec) const
+{
   constexpr auto modSize = sizeof(TSmallEventData::module);
   constexpr auto chSize = sizeof(TSmallEventData::channel);
   constexpr auto tsSize = sizeof(TSmallEventData::timeStampNs);
   constexpr auto enSize = sizeof(TSmallEventData::energy);
   constexpr auto enShortSize = sizeof(TSmallEventData::energyShort);
-  constexpr auto oneHitSize = modSize + chSize + tsSize + enSize + enShortSize;
-  constexpr auto wfSize = sizeof(TSmallEventData::waveform[0]);
-
-  while (fRecording) {
-    {
-      std::lock_guard<std::mutex> lock(fRawDataQueMutex);
-      if (!fRawDataQue.empty()) {
-        localData = std::move(fRawDataQue.front());
-        fRawDataQue.pop_front();
-      }
-    }
+  constexpr auto qaSize = sizeof(TSmallEventData::qaFlags);
+  constexpr auto classSize = sizeof(TSmallEventData::particleClass);
+  constexpr auto enCalSize = sizeof(TSmallEventData::energyCal);
+  constexpr auto oneHitSize = modSize + chSize + tsSize + enSize +
+                              enShortSize + qaSize + classSize + enCalSize;
+
+  uint32_t dataSize = 0;
+  for (const auto &event : data) {
+    auto smallEvent = new TSmallEventData;
+    ConvertEvent(*event, *smallEvent);
+    dataVec.emplace_back(smallEvent);
+    dataSize += oneHitSize + GetTraceSize(*smallEvent);
+  }
+  return dataSize;
+}
 
-    if (localData) {
-      std::vector<TSmallEventData *> localDataVec;
-      uint32_t localDataSize = 0;
-
-      for (const auto &event : *localData) {
-        if (fRecording == false) break;
-        TSmallEventData smallEvent;
-        smallEvent.module = event->module;
-        smallEvent.channel = event->channel;
-        smallEvent.timeStampNs = event->timeStampNs;
-        smallEvent.energy = event->energy;
-        smallEvent.energyShort = event->energyShort;
-        smallEvent.waveform.clear();
-        if (event->waveformSize > 0)
-          smallEvent.waveform.insert(smallEvent.waveform.end(),
-                                     event->analogProbe1.begin(),
-                                     event->analogProbe1.end());
-
-        localDataVec.emplace_back(new TSmallEventData(smallEvent));
-        localDataSize += oneHitSize + event->waveformSize * wfSize;
-      }
+void TDataRecorder::SortData(std::vector<TSmallEventData *> &dataVec)
+{
+  TRACE_SCOPE("Sort");
+  __gnu_parallel::sort(dataVec.begin(), dataVec.end(),
+                       [](const auto &a, const auto &b) {
+                         return a->timeStampNs < b->timeStampNs;
+                       });
+}
 
-      __gnu_parallel::sort(localDataVec.begin(), localDataVec.end(),
-                           [](const auto &a, const auto &b) {
-                             return a->timeStampNs < b->timeStampNs;
-                           });
+void TDataRecorder::ConvertBatch()
+{
+  std::unique_ptr<DAQData_t> localData = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(fRawDataQueMutex);
+    if (fRawDataQue.empty()) return;  // Taken by PostProcess
+    localData = std::move(fRawDataQue.front());
+    fRawDataQue.pop_front();
+  }
 
-      {
-        std::lock_guard<std::mutex> lock(fDataVecMutex);
-        fDataVec.insert(fDataVec.end(), localDataVec.begin(),
-                        localDataVec.end());
-        fDataSize += localDataSize;
-      }
+  TRACE_SCOPE("ConvertBatch");
+  std::vector<TSmallEventData *> localDataVec;
+  auto localDataSize = ConvertData(*localData, localDataVec);
+  auto &stats = TPipelineStats::GetInstance();
+  stats.RecordBatch(PipelineStage::Conversion, localDataVec);
 
-      localData.reset();
-    } else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  SortData(localDataVec);
+  stats.RecordBatch(PipelineStage::Sort, localDataVec);
+
+  {
+    std::unique_lock<std::mutex> lock(fDataVecMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      TRACE_SCOPE("WaitDataVecMutex");
+      lock.lock();
     }
+    fDataVec.insert(fDataVec.end(), localDataVec.begin(), localDataVec.end());
+    fDataSize += localDataSize;
   }
+
+  CheckRollover();
 }
 
-void TDataRecorder::WritingThread()
+void TDataRecorder::CheckRollover()
 {
-  ROOT::EnableThreadSafety();
   constexpr auto mergineSize = 1.1;
-
-  while (fRecording) {
-    bool timeCondition = false;
-    bool sizeCondition = false;
-    std::vector<TSmallEventData *> localDataVec;
-
-    auto now = std::chrono::system_clock::now();
-    {
-      std::lock_guard<std::mutex> lock(fDataVecMutex);
-      timeCondition = now - fLastWrite > fMaxTime;
-      sizeCondition = fDataSize > fFileSize * mergineSize;
-      if (timeCondition || sizeCondition) {
-        localDataVec.insert(localDataVec.end(), fDataVec.begin(),
-                            fDataVec.end());
-        fDataVec.clear();
-        fDataSize = 0;
-      }
+  auto now = std::chrono::system_clock::now();
+  auto localDataVec = std::make_shared<std::vector<TSmallEventData *>>();
+  bool timeCondition = false;
+  bool sizeCondition = false;
+  {
+    std::unique_lock<std::mutex> lock(fDataVecMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      TRACE_SCOPE("WaitDataVecMutex");
+      lock.lock();
     }
+    timeCondition = now - fLastWrite > fMaxTime;
+    sizeCondition = fDataSize > fFileSize * mergineSize;
+    if (!timeCondition && !sizeCondition) return;
+    localDataVec->swap(fDataVec);
+    fDataSize = 0;
+    fLastWrite = now;
+  }
 
-    if (!localDataVec.empty()) {
-      __gnu_parallel::sort(localDataVec.begin(), localDataVec.end(),
-                           [](const auto &a, const auto &b) {
-                             return a->timeStampNs < b->timeStampNs;
-                           });
-
-      if (sizeCondition) {
-        auto th = uint32_t(localDataVec.size() / mergineSize);
-        std::lock_guard<std::mutex> lock(fDataVecMutex);
-        fDataVec.insert(fDataVec.end(), localDataVec.begin() + th,
-                        localDataVec.end());
-        localDataVec.resize(th);
-      }
+  TTaskScheduler::GetInstance().Submit(
+      fWriteQueue, [this, localDataVec, timeCondition, sizeCondition] {
+        WriteFile(*localDataVec, timeCondition, sizeCondition);
+      });
+}
 
-      auto fileName = fFileName;
-      {
-        std::lock_guard<std::mutex> lock(fFileMutex);
-        fileName += std::string("_") + std::to_string(fFileVersion) + ".root";
-        fFileVersion++;
-        fLastWrite = now;
-        std::cout << "Writing to " << fileName;
-        if (timeCondition) std::cout << " due to time limit";
-        if (sizeCondition) std::cout << " due to size limit";
-        std::cout << std::endl;
-      }
-      TFile *file = new TFile(fileName.c_str(), "RECREATE");
-      TTree *tree = new TTree("data", "data");
-      TSmallEventData event;
-      tree->Branch("Mod", &event.module, "Mod/b");
-      tree->Branch("Ch", &event.channel, "Ch/b");
-      tree->Branch("FineTS", &event.timeStampNs, "FineTS/D");
-      tree->Branch("ChargeLong", &event.energy, "ChargeLong/s");
-      tree->Branch("ChargeShort", &event.energyShort, "ChargeShort/S");
-      tree->Branch("Signal", &event.waveform);
-      for (const auto &data : localDataVec) {
-        event.channel = data->channel;
-        event.module = data->module;
-        event.timeStampNs = data->timeStampNs;
-        event.energy = data->energy;
-        event.energyShort = data->energyShort;
-        event.waveform = data->waveform;
-        tree->Fill();
-        delete data;
-      }
-      file->Write();
-      file->Close();
-      delete file;
+void TDataRecorder::WriteFile(std::vector<TSmallEventData *> &localDataVec,
+                              bool timeCondition, bool sizeCondition)
+{
+  constexpr auto mergineSize = 1.1;
+  if (localDataVec.empty()) return;
 
-      {
-        std::lock_guard<std::mutex> lock(fFileMutex);
-        std::cout << "Writing to " << fileName << " done" << std::endl;
-      }
+  TRACE_SCOPE("Rollover");
+  SortData(localDataVec);
+
+  if (sizeCondition) {
+    auto th = uint32_t(localDataVec.size() / mergineSize);
+    std::unique_lock<std::mutex> lock(fDataVecMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      TRACE_SCOPE("WaitDataVecMutex");
+      lock.lock();
+    }
+    fDataVec.insert(fDataVec.end(), localDataVec.begin() + th,
+                    localDataVec.end());
+    localDataVec.resize(th);
+  }
 
-      localDataVec.clear();
+  std::string fileName;
+  {
+    std::lock_guard<std::mutex> lock(fFileMutex);
+    fileName = NextFileName();
+    std::cout << "Writing to " << fileName;
+    if (timeCondition) std::cout << " due to time limit";
+    if (sizeCondition) std::cout << " due to size limit";
+    std::cout << std::endl;
+  }
+  FillFile(fileName, localDataVec);
+
+  {
+    std::lock_guard<std::mutex> lock(fFileMutex);
+    std::cout << "Writing to " << fileName << " done" << std::endl;
+  }
+}
 
-    } else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void TDataRecorder::FillFile(const std::string &fileName,
+                             std::vector<TSmallEventData *> &dataVec) const
+{
+  if (dataVec.empty()) return;
+
+  TFile *file = new TFile(fileName.c_str(), "RECREATE");
+  TSmallEventData event;
+  auto trees = CreateTrees(event);
+  auto oldest = dataVec.front()->readoutTime;
+  {
+    TRACE_SCOPE("Fill");
+    for (const auto &data : dataVec) {
+      event = *data;
+      SelectTree(trees, event)->Fill();
+      if (data->readoutTime < oldest) oldest = data->readoutTime;
+      delete data;
     }
   }
+  TPipelineStats::GetInstance().RecordLatency(PipelineStage::Write, oldest);
+  {
+    TRACE_SCOPE("FileWrite");
+    file->Write();
+    file->Close();
+    delete file;
+  }
+  dataVec.clear();
 }
 
 void TDataRecorder::StartRecording()
 {
   if (fRecording) return;
   fRecording = true;
-  fFileVersion = 0;
   fLastWrite = std::chrono::system_clock::now();
   fRawDataQue.clear();
   fDataVec.clear();
-
-  constexpr auto nThreads = 8;
-  for (auto i = 0U; i < nThreads; i++) {
-    fThreadPool.push_back(std::thread(&TDataRecorder::WritingThread, this));
-    fThreadPool.push_back(std::thread(&TDataRecorder::ConvertingThread, this));
-  }
+  fDataSize = 0;
 }
 
 void TDataRecorder::StopRecording()
 {
   if (!fRecording) return;
   fRecording = false;
-  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  // Batches in flight are finished, the rest is written by PostProcess
+  auto &scheduler = TTaskScheduler::GetInstance();
+  scheduler.Wait(fConvertQueue);
+  scheduler.Wait(fWriteQueue);
   PostProcess();
 
-  for (auto &thread : fThreadPool) {
-    if (thread.joinable()) thread.join();
-  }
-  fThreadPool.clear();
+  TRACE_DUMP(fFileName + "_trace.json");
 }
 
 void TDataRecorder::PostProcess()
 {
+  TRACE_SCOPE("PostProcess");
   // convert all data to root file
-  // NEED refactoring
-  // TOO REDUNDANT
 
   std::unique_ptr<DAQData_t> localRawData = nullptr;
   {
@@ -237,21 +383,7 @@ void TDataRecorder::PostProcess()
 
   std::vector<TSmallEventData *> localData;
   if (localRawData) {
-    for (const auto &event : *localRawData) {
-      TSmallEventData smallEvent;
-      smallEvent.module = event->module;
-      smallEvent.channel = event->channel;
-      smallEvent.timeStampNs = event->timeStampNs;
-      smallEvent.energy = event->energy;
-      smallEvent.energyShort = event->energyShort;
-      smallEvent.waveform.clear();
-      if (event->waveformSize > 0)
-        smallEvent.waveform.insert(smallEvent.waveform.end(),
-                                   event->analogProbe1.begin(),
-                                   event->analogProbe1.end());
-
-      localData.emplace_back(new TSmallEventData(smallEvent));
-    }
+    ConvertData(*localRawData, localData);
     localRawData.reset();
   }
 
@@ -260,39 +392,15 @@ void TDataRecorder::PostProcess()
     if (localData.size() > 0)
       fDataVec.insert(fDataVec.end(), localData.begin(), localData.end());
     if (fDataVec.empty()) return;
-
-    __gnu_parallel::sort(fDataVec.begin(), fDataVec.end(),
-                         [](const auto &a, const auto &b) {
-                           return a->timeStampNs < b->timeStampNs;
-                         });
+    SortData(fDataVec);
   }
 
-  auto fileName = fFileName;
-  fileName += std::string("_") + std::to_string(fFileVersion) + ".root";
-  fFileVersion++;
-  TFile *file = new TFile(fileName.c_str(), "RECREATE");
-  TTree *tree = new TTree("data", "data");
-  std::cout << "Writing to " << fileName << std::endl;
-
-  TSmallEventData event;
-  tree->Branch("Mod", &event.module, "Mod/b");
-  tree->Branch("Ch", &event.channel, "Ch/b");
-  tree->Branch("FineTS", &event.timeStampNs, "FineTS/D");
-  tree->Branch("ChargeLong", &event.energy, "ChargeLong/s");
-  tree->Branch("ChargeShort", &event.energyShort, "ChargeShort/S");
-  tree->Branch("Signal", &event.waveform);
-  for (const auto &data : fDataVec) {
-    event.channel = data->channel;
-    event.module = data->module;
-    event.timeStampNs = data->timeStampNs;
-    event.energy = data->energy;
-    event.energyShort = data->energyShort;
-    event.waveform = data->waveform;
-    tree->Fill();
-    delete data;
+  std::string fileName;
+  {
+    std::lock_guard<std::mutex> lock(fFileMutex);
+    fileName = NextFileName();
   }
-  file->Write();
-  file->Close();
-  delete file;
+  std::cout << "Writing to " << fileName << std::endl;
+  FillFile(fileName, fDataVec);
   std::cout << "Writing to " << fileName << " done" << std::endl;
 }
\ No newline at end of file
@@ -1,10 +1,33 @@
 #include "TDataTaking.hpp"
 
+#include <atomic>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 
-TDataTaking::TDataTaking() {}
+#include "TPipelineStats.hpp"
+#include "TThreadAffinity.hpp"
+#include "TTrace.hpp"
+
+namespace
+{
+// Waits for every task, then rethrows the first exception
+void WaitAll(std::vector<std::future<void>> &results)
+{
+  std::exception_ptr error;
+  for (auto &result : results) {
+    try {
+      result.get();
+    } catch (...) {
+      if (!error) error = std::current_exception();
+    }
+  }
+  if (error) std::rethrow_exception(error);
+}
+}  // namespace
+
+TDataTaking::TDataTaking() { ResetEventsVec(); }
 
 TDataTaking::~TDataTaking() {}
 
@@ -12,7 +35,9 @@ std::vector<uint32_t> TDataTaking::GetNumberOfCh()
 {
   std::vector<uint32_t> numberOfHW;
   for (const auto &digitizer : fDigitizers) {
-    numberOfHW.push_back(digitizer->GetNumberOfCh());
+    auto &dig = *digitizer;
+    auto nCh = dig.Post([&dig] { return dig.GetNumberOfCh(); });
+    numberOfHW.push_back(nCh.get());
   }
   return numberOfHW;
 }
@@ -21,11 +46,41 @@ std::vector<uint32_t> TDataTaking::GetDeltaT()
 {
   std::vector<uint32_t> deltaT;
   for (const auto &digitizer : fDigitizers) {
-    deltaT.push_back(digitizer->GetDeltaT());
+    auto &dig = *digitizer;
+    deltaT.push_back(dig.Post([&dig] { return dig.GetDeltaT(); }).get());
   }
   return deltaT;
 }
 
+std::vector<uint32_t> TDataTaking::GetPreTrigger()
+{
+  std::vector<uint32_t> preTrigger;
+  for (const auto &digitizer : fDigitizers) {
+    auto &dig = *digitizer;
+    preTrigger.push_back(
+        dig.Post([&dig] { return dig.GetPreTrigger(); }).get());
+  }
+  return preTrigger;
+}
+
+std::vector<std::string> TDataTaking::GetFirmware()
+{
+  std::vector<std::string> firmware;
+  for (const auto &digitizer : fDigitizers) {
+    firmware.push_back(digitizer->GetFirmware());
+  }
+  return firmware;
+}
+
+std::vector<uint8_t> TDataTaking::GetModuleID()
+{
+  std::vector<uint8_t> moduleID;
+  for (const auto &digitizer : fDigitizers) {
+    moduleID.push_back(digitizer->GetModuleNumber());
+  }
+  return moduleID;
+}
+
 void TDataTaking::LoadConfigFileList(const std::string &listName)
 {
   std::ifstream fin(listName);
@@ -67,68 +122,104 @@ void TDataTaking::LoadConfigFiles()
   }
 }
 
-void TDataTaking::OpenDigitizers()
+void TDataTaking::RunOnDigitizers(
+    const std::function<void(TDigitizer &)> &func)
 {
-  // By CAEN documents, open and close should be done in the same thread
+  // Tasks own a copy of func, and all of them finish before an exception
+  // is passed on, so nothing refers to this frame after it returns
+  std::vector<std::future<void>> results;
   for (auto &digitizer : fDigitizers) {
-    digitizer->OpenDigitizer();
+    auto &dig = *digitizer;
+    results.push_back(dig.Post([&dig, func] { func(dig); }));
   }
+  WaitAll(results);
+}
+
+void TDataTaking::OpenDigitizers()
+{
+  // By CAEN documents, open and close should be done in the same thread.
+  // Each board has its own owner thread, so boards are opened in parallel.
+  RunOnDigitizers([](TDigitizer &dig) { dig.OpenDigitizer(); });
 }
 
 void TDataTaking::CloseDigitizers()
 {
-  // By CAEN documents, open and close should be done in the same thread
-  for (auto &digitizer : fDigitizers) {
-    digitizer->CloseDigitizer();
-  }
+  RunOnDigitizers([](TDigitizer &dig) { dig.CloseDigitizer(); });
 }
 
 void TDataTaking::ConfigDigitizers()
 {
   LoadConfigFiles();
-  std::vector<std::thread> threads;
-  for (auto &digitizer : fDigitizers) {
-    threads.emplace_back([&digitizer, this] {
-      digitizer->ConfigDigitizer();
-      if (fForceTrace) digitizer->ForceTrace();
-      digitizer->SetDataFormat();
-    });
+  RunOnDigitizers([this](TDigitizer &dig) { ConfigDigitizer(dig); });
+}
+
+void TDataTaking::ConfigDigitizer(TDigitizer &dig)
+{
+  dig.ConfigDigitizer();
+  if (fForceTrace) dig.ForceTrace();
+  dig.SetDataFormat();
+}
+
+uint32_t TDataTaking::ReloadDigitizers()
+{
+  if (!fRunning) {
+    ConfigDigitizers();
+    return fDigitizers.size();
   }
-  for (auto &thread : threads) {
-    thread.join();
+
+  std::atomic<uint32_t> nReconfigured{0};
+  std::vector<std::future<void>> results;
+  for (auto i = 0U; i < fDigitizers.size(); i++) {
+    auto &dig = *fDigitizers[i];
+    if (!dig.LoadParameters(fConfigFileList[i])) continue;
+    std::cout << "Reconfiguring module " << int(dig.GetModuleNumber())
+              << std::endl;
+    results.push_back(dig.Post([&dig, &nReconfigured, this] {
+      if (dig.Reconfigure(fForceTrace)) nReconfigured++;
+    }));
   }
+  WaitAll(results);
+  return nReconfigured;
 }
 
-void TDataTaking::StartAcquisition()
+bool TDataTaking::ReconfigureDigitizer(uint8_t moduleID)
 {
-  ResetEventsVec();
-
-  std::vector<std::thread> threads;
-  for (auto &digitizer : fDigitizers) {
-    threads.emplace_back([&digitizer] { digitizer->StartAcquisition(); });
+  for (auto i = 0U; i < fDigitizers.size(); i++) {
+    auto &dig = *fDigitizers[i];
+    if (dig.GetModuleNumber() != moduleID) continue;
+    dig.LoadParameters(fConfigFileList[i]);
+    if (fRunning)
+      dig.Post([&dig, this] { dig.Reconfigure(fForceTrace); }).get();
+    else
+      dig.Post([&dig, this] { ConfigDigitizer(dig); }).get();
+    return true;
   }
-  for (auto &thread : threads) {
-    thread.join();
+  return false;
+}
+
+void TDataTaking::StartAcquisition()
+{
+  {
+    std::lock_guard<std::mutex> lock(fEventsVecMutex);
+    ResetEventsVec();
   }
 
+  RunOnDigitizers([](TDigitizer &dig) { dig.StartAcquisition(); });
+
   fRunning = true;
   fAcquisitionThreads.clear();
   fAcquisitionThreads.emplace_back(&TDataTaking::FetchingData, this);
 
+  // Start signals are sent one board after another, as before
   for (auto &digitizer : fDigitizers) {
-    digitizer->SendStartSignal();
+    auto &dig = *digitizer;
+    dig.Post([&dig] { dig.SendStartSignal(); }).get();
   }
 }
 
 void TDataTaking::StopAcquisition()
 {
-  std::vector<std::thread> threads;
-  for (auto &digitizer : fDigitizers) {
-    threads.emplace_back([&digitizer] { digitizer->StopAcquisition(); });
-  }
-  for (auto &thread : threads) {
-    thread.join();
-  }
+  RunOnDigitizers([](TDigitizer &dig) { dig.StopAcquisition(); });
 
   fRunning = false;
   for (auto &thread : fAcquisitionThreads) {
@@ -138,23 +229,43 @@ void TDataTaking::StopAcquisition()
 
 void TDataTaking::ResetEventsVec()
 {
+  // Sized like the last batch instead of a fixed 1M entries
   fEventsVec.reset(new std::vector<std::unique_ptr<TEventData>>);
-  fEventsVec->reserve(1024 * 1024);
+  fEventsVec->reserve(fLastBatchSize);
 }
 
-std::unique_ptr<DAQData_t> TDataTaking::GetData()
+std::unique_ptr<DAQData_t> TDataTaking::GetData(
+    std::chrono::milliseconds timeout)
 {
-  std::lock_guard<std::mutex> lock(fEventsVecMutex);
+  std::unique_lock<std::mutex> lock(fEventsVecMutex);
+  fEventsVecCV.wait_for(lock, timeout, [this] {
+    return !fEventsVec->empty() || fInterrupted;
+  });
+  fInterrupted = false;
+  if (fEventsVec->empty()) return nullptr;
+
   auto buf = std::move(fEventsVec);
+  fLastBatchSize = buf->size();
   ResetEventsVec();
   return buf;
 }
 
+void TDataTaking::Interrupt()
+{
+  {
+    std::lock_guard<std::mutex> lock(fEventsVecMutex);
+    fInterrupted = true;
+  }
+  fEventsVecCV.notify_all();
+}
+
 void TDataTaking::FetchingData()
 {
   std::unique_ptr<DAQData_t> localEventsVec;
   localEventsVec.reset(new std::vector<std::unique_ptr<TEventData>>);
 
+  TRACE_THREAD_NAME("FetchingData");
+  TThreadAffinity::GetInstance().Apply("Fetching");
   while (fRunning) {
     for (auto &digitizer : fDigitizers) {
       auto data = digitizer->GetEvents();
@@ -164,15 +275,31 @@ void TDataTaking::FetchingData()
     }
 
     if (localEventsVec->size() > 0) {
-      {
-        std::lock_guard<std::mutex> lock(fEventsVecMutex);
-        fEventsVec->insert(fEventsVec->end(),
-                           std::make_move_iterator(localEventsVec->begin()),
-                           std::make_move_iterator(localEventsVec->end()));
-      }
-      localEventsVec->clear();
+      AggregateEvents(*localEventsVec);
     } else {
       std::this_thread::sleep_for(std::chrono::milliseconds(fSleepTime));
     }
   }
 }
+
+void TDataTaking::AggregateEvents(DAQData_t &events)
+{
+  auto &stats = TPipelineStats::GetInstance();
+  stats.RecordBatch(PipelineStage::Aggregation, events);
+  for (auto &stage : fProcessingStages) {
+    TRACE_SCOPE("ProcessingStage");
+    stage->Process(events);
+  }
+  if (!fProcessingStages.empty()) {
+    stats.RecordBatch(PipelineStage::Processing, events);
+  }
+  {
+    TRACE_SCOPE("Aggregate");
+    std::lock_guard<std::mutex> lock(fEventsVecMutex);
+    fEventsVec->insert(fEventsVec->end(),
+                       std::make_move_iterator(events.begin()),
+                       std::make_move_iterator(events.end()));
+  }
+  fEventsVecCV.notify_one();
+  events.clear();
+}
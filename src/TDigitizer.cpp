@@ -2,27 +2,94 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <cctype>
 #include <chrono>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
-TDigitizer::TDigitizer() {}
+#include "TPipelineStats.hpp"
+#include "TThreadAffinity.hpp"
+#include "TTrace.hpp"
 
-TDigitizer::~TDigitizer() {}
+namespace
+{
+std::string ToLower(std::string str)
+{
+  std::transform(str.begin(), str.end(), str.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return str;
+}
+
+// FELib returns numbers in its own format (e.g. "0.0" for "0")
+bool SameValue(const std::string &a, const std::string &b)
+{
+  if (ToLower(a) == ToLower(b)) return true;
+  try {
+    std::size_t posA, posB;
+    auto valA = std::stod(a, &posA);
+    auto valB = std::stod(b, &posB);
+    return posA == a.size() && posB == b.size() && valA == valB;
+  } catch (...) {
+    return false;
+  }
+}
+}  // namespace
+
+TDigitizer::TDigitizer()
+{
+  fOwnerThread = std::thread(&TDigitizer::OwnerLoop, this);
+}
+
+TDigitizer::~TDigitizer()
+{
+  {
+    std::lock_guard<std::mutex> lock(fCommandMutex);
+    fOwnerRunning = false;
+  }
+  fCommandCond.notify_one();
+  if (fOwnerThread.joinable()) fOwnerThread.join();
+}
 
-void TDigitizer::LoadParameters(const std::string &filename)
+void TDigitizer::OwnerLoop()
 {
+  TRACE_THREAD_NAME("DigitizerOwner");
+  while (true) {
+    std::function<void()> command;
+    {
+      std::unique_lock<std::mutex> lock(fCommandMutex);
+      fCommandCond.wait(
+          lock, [this] { return !fCommands.empty() || !fOwnerRunning; });
+      // Pending commands are finished before leaving
+      if (fCommands.empty()) break;
+      command = std::move(fCommands.front());
+      fCommands.pop_front();
+    }
+    command();
+  }
+}
+
+bool TDigitizer::LoadParameters(const std::string &filename)
+{
+  nlohmann::json parameters;
   std::ifstream fin(filename);
-  fin >> fParameters;
+  fin >> parameters;
   fin.close();
+  auto changed = parameters != fParameters;
+  fParameters = std::move(parameters);
 
   // Checking and sanitizing the parameters
   // NYI
+
+  return changed;
 }
 
 uint32_t TDigitizer::GetNumberOfCh()
@@ -39,6 +106,23 @@ uint32_t TDigitizer::GetDeltaT()
   return static_cast<uint32_t>(1000 / std::stoi(buf));
 }
 
+uint32_t TDigitizer::GetPreTrigger()
+{
+  uint32_t preTrigger = 0;  // ns, as ch_pretrg
+  if (!fParameters.contains("channel_parameters")) return preTrigger;
+  for (auto &ch : fParameters["channel_parameters"].items()) {
+    if (!ch.value().contains("ch_pretrg")) continue;
+    auto value = static_cast<uint32_t>(
+        std::stoul(ch.value()["ch_pretrg"]["value"].get<std::string>()));
+    if (preTrigger == 0 || value < preTrigger) preTrigger = value;
+  }
+  if (preTrigger == 0) return preTrigger;
+
+  // At least one sample, 0 means unknown
+  const auto deltaT = std::max(1U, GetDeltaT());  // ns per sample
+  return std::max(1U, preTrigger / deltaT);
+}
+
 void TDigitizer::OpenDigitizer()
 {
   auto URL = fParameters["URL"].get<std::string>();
@@ -48,6 +132,7 @@ void TDigitizer::OpenDigitizer()
 
   SendCommand("/cmd/Reset");
   SendCommand("/cmd/CalibrateADC");
+  fDeviceState.clear();
 
   fFW = fParameters["FW"].get<std::string>();
 
@@ -116,23 +201,20 @@ void TDigitizer::PrintDigitizerInfo() const
 
 void TDigitizer::ConfigDigitizer()
 {
+  if (fDeviceState.empty()) ReadDeviceState();
+  fNSent = fNSkipped = 0;
+  auto start = std::chrono::steady_clock::now();
+
   // Module settings
   for (auto &modPar : fParameters["module_parameters"].items()) {
     auto path = modPar.value()["path"].get<std::string>();
     auto value = modPar.value()["value"].get<std::string>();
     // std::cout << "Path: " << path << "\tValue: " << value << std::endl;
-    SetParameter(path, value);
+    ApplyParameter(path, value);
   }
 
   // Channel settings
-  for (auto &ch : fParameters["channel_parameters"].items()) {
-    for (auto &chPar : ch.value().items()) {
-      auto path = chPar.value()["path"].get<std::string>();
-      auto value = chPar.value()["value"].get<std::string>();
-      // std::cout << "Path: " << path << "\tValue: " << value << std::endl;
-      SetParameter(path, value);
-    }
-  }
+  ApplyChannelParameters();
 
   // VTraces
   for (auto &vtrace : fParameters["trace_parameters"].items()) {
@@ -140,17 +222,181 @@ void TDigitizer::ConfigDigitizer()
       auto path = vtracePar.value()["path"].get<std::string>();
       auto value = vtracePar.value()["value"].get<std::string>();
       // std::cout << "Path: " << path << "\tValue: " << value << std::endl;
-      SetParameter(path, value);
+      ApplyParameter(path, value);
     }
   }
+
+  // The device rounds values and changes dependent parameters, so the cache
+  // holds what it reads back rather than what was requested
+  if (fNSent > 0) {
+    fDeviceState.clear();
+    ReadDeviceState();
+  }
+
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << "Module " << int(fModNo) << ": " << fNSent
+            << " parameters sent, " << fNSkipped << " unchanged ("
+            << elapsed << " s)" << std::endl;
 }
 
-void TDigitizer::ForceTrace() { SetParameter("/par/waveforms", "TRUE"); }
+void TDigitizer::ForceTrace() { ApplyParameter("/par/waveforms", "TRUE"); }
 
-void TDigitizer::StartAcquisition()
+void TDigitizer::ReadDeviceState()
 {
+  // First call with no buffer returns the required size
+  auto size = CAEN_FELib_GetDeviceTree(fHandle, nullptr, 0);
+  if (size < 0) {
+    CheckError(size);
+    return;
+  }
+  std::string buf(size + 1, '\0');
+  auto err = CAEN_FELib_GetDeviceTree(fHandle, buf.data(), buf.size());
+  if (err < 0) {
+    CheckError(err);
+    return;
+  }
+
+  try {
+    auto tree = nlohmann::json::parse(buf.c_str());
+    FlattenDeviceTree(tree, "");
+  } catch (const std::exception &e) {
+    std::cerr << "Failed to parse the device tree: " << e.what() << std::endl;
+    fDeviceState.clear();
+  }
+}
+
+void TDigitizer::FlattenDeviceTree(const nlohmann::json &node,
+                                   const std::string &path)
+{
+  // Layout: {"par": {name: {"value", "accessmode", ...}},
+  //          "ch": {"0": {"par": ...}, ...}, "vtrace": ...}
+  for (auto &item : node.items()) {
+    if (item.key() == "handle" || !item.value().is_object()) continue;
+    if (item.key() == "par") {
+      for (auto &par : item.value().items()) {
+        auto &entry = par.value();
+        if (!entry.is_object() || !entry.contains("value")) continue;
+        if (entry.contains("accessmode") &&
+            entry["accessmode"].value("value", "") != "READ_WRITE")
+          continue;
+        if (!entry["value"].is_string()) continue;
+        fDeviceState[ToLower(path + "/par/" + par.key())] =
+            entry["value"].get<std::string>();
+      }
+    } else if (item.key() == "ch" || item.key() == "vtrace" || path != "") {
+      FlattenDeviceTree(item.value(), path + "/" + item.key());
+    }
+  }
+}
+
+void TDigitizer::ApplyChannelParameters()
+{
+  // name -> value -> channels still to be written
+  std::map<std::string, std::map<std::string, std::vector<uint32_t>>> groups;
+  const std::string chPrefix = "/ch/";
+  const std::string parPrefix = "/par/";
+
+  for (auto &ch : fParameters["channel_parameters"].items()) {
+    for (auto &chPar : ch.value().items()) {
+      auto path = chPar.value()["path"].get<std::string>();
+      auto value = chPar.value()["value"].get<std::string>();
+
+      auto parPos = path.find(parPrefix);
+      uint32_t iCh = 0;
+      try {
+        if (path.compare(0, chPrefix.size(), chPrefix) != 0 ||
+            parPos == std::string::npos)
+          throw std::invalid_argument(path);
+        std::size_t pos;
+        auto chStr = path.substr(chPrefix.size(), parPos - chPrefix.size());
+        iCh = std::stoul(chStr, &pos);
+        if (pos != chStr.size()) throw std::invalid_argument(path);
+      } catch (const std::exception &) {
+        ApplyParameter(path, value);  // Not a plain /ch/N/par/X path
+        continue;
+      }
+
+      auto it = fDeviceState.find(ToLower(path));
+      if (it != fDeviceState.end() && SameValue(it->second, value)) {
+        fNSkipped++;
+        continue;
+      }
+      groups[path.substr(parPos + parPrefix.size())][value].push_back(iCh);
+    }
+  }
+
+  for (auto &[name, values] : groups) {
+    for (auto &[value, chs] : values) {
+      std::sort(chs.begin(), chs.end());
+      for (std::size_t first = 0; first < chs.size();) {
+        auto last = first;
+        while (last + 1 < chs.size() && chs[last + 1] == chs[last] + 1) last++;
+
+        auto range = std::to_string(chs[first]);
+        if (last > first) range += ".." + std::to_string(chs[last]);
+        fNSent++;
+        auto ok = SetParameter(chPrefix + range + parPrefix + name, value);
+        for (auto i = first; i <= last; i++) {
+          auto path = chPrefix + std::to_string(chs[i]) + parPrefix + name;
+          if (ok) {
+            fDeviceState[ToLower(path)] = value;
+          } else {
+            fDeviceState.erase(ToLower(path));
+            // The range path may be rejected, write the channels one by one
+            if (last > first) ApplyParameter(path, value);
+          }
+        }
+        first = last + 1;
+      }
+    }
+  }
+}
+
+bool TDigitizer::ApplyParameter(const std::string &path,
+                                const std::string &value)
+{
+  auto key = ToLower(path);
+  auto it = fDeviceState.find(key);
+  if (it != fDeviceState.end() && SameValue(it->second, value)) {
+    fNSkipped++;
+    return true;
+  }
+
+  fNSent++;
+  if (SetParameter(path, value)) {
+    fDeviceState[key] = value;
+    return true;
+  }
+  // Unknown state, send again next time
+  fDeviceState.erase(key);
+  return false;
+}
+
+void TDigitizer::ApplyBatching()
+{
+  if (!fParameters.contains("ReadoutBatching")) return;
+  const auto &batching = fParameters["ReadoutBatching"];
+  fTargetLatency = batching.value("TargetLatency", fTargetLatency);
+  fTargetBatchBytes = batching.value("TargetBatchBytes", fTargetBatchBytes);
+  fTimeOut = batching.value("MaxTimeOut", fTimeOut);
+}
+
+void TDigitizer::StartAcquisition(bool clearEvents)
+{
+  ApplyBatching();
+  if (clearEvents) {
+    fRunStart = TPipelineStats::Now();
+    fTimeOffset = 0.;
+  } else {
+    fTimeOffset = double(TPipelineStats::Now() - fRunStart);
+  }
   SendCommand("/cmd/ArmAcquisition");
-  MakeNewEventsVec();
+  {
+    std::lock_guard<std::mutex> lock(fEventsDataMutex);
+    if (clearEvents || !fEventsVec) MakeNewEventsVec();
+  }
 
   fRunning = true;
   if (fFW == "DPP-PSD")
@@ -178,6 +424,35 @@ void TDigitizer::StopAcquisition()
   SendCommand("/cmd/ClearData");
 }
 
+bool TDigitizer::IsTimeSynchronised()
+{
+  // Free running boards start by software or on their first trigger
+  std::string startMode;
+  std::string extClock;
+  GetParameter("/par/startmode", startMode);
+  GetParameter("/par/dt_ext_clock", extClock);
+  auto freeRunning = startMode == "START_MODE_SW" ||
+                     startMode == "START_MODE_FIRST_TRG";
+  return !freeRunning || extClock == "TRUE";
+}
+
+bool TDigitizer::Reconfigure(bool forceTrace)
+{
+  if (IsTimeSynchronised()) {
+    std::cerr << "Module " << int(fModNo)
+              << " is time synchronised, stop the run and reload to apply"
+              << std::endl;
+    return false;
+  }
+  StopAcquisition();
+  ConfigDigitizer();
+  if (forceTrace) ForceTrace();
+  SetDataFormat();
+  StartAcquisition(false);
+  SendStartSignal();
+  return true;
+}
+
 void TDigitizer::SetDataFormat()
 {
   // Define readout data structure
@@ -196,88 +471,116 @@ void TDigitizer::SetDataFormat()
   CheckError(err);
 }
 
+void TDigitizer::PushEvent(TEventData &eventData,
+                           const std::vector<uint8_t> &digitalProbe1,
+                           const std::vector<uint8_t> &digitalProbe2,
+                           std::vector<std::unique_ptr<TEventData>> &buf)
+{
+  eventData.readoutTime = TPipelineStats::Now();
+  PackDigitalProbe(digitalProbe1.data(), eventData.waveformSize,
+                   eventData.digitalProbe1.data());
+  PackDigitalProbe(digitalProbe2.data(), eventData.waveformSize,
+                   eventData.digitalProbe2.data());
+  buf.emplace_back(std::make_unique<TEventData>(eventData));
+}
+
 void TDigitizer::FetchEventsPSD()
 {
+  // Before allocating, so the buffers are on the node of the thread
+  TThreadAffinity::GetInstance().ApplyReadout(fModNo);
   std::string buf;
   GetParameter("/par/reclen", buf);
   const auto recLen = static_cast<uint32_t>(std::stoi(buf));
   TEventData eventData(recLen);
   eventData.module = fModNo;
+  // FELib writes one byte per sample, packed into eventData after reading
+  std::vector<uint8_t> digitalProbe1(recLen);
+  std::vector<uint8_t> digitalProbe2(recLen);
+  const auto maxEvents = GetMaxBatchEvents(recLen);
   std::vector<std::unique_ptr<TEventData>> eventBuffer;
-  eventBuffer.reserve(10000);
+  eventBuffer.reserve(maxEvents);
+  uint64_t nCalls = 0;
+  uint64_t nTimeouts = 0;
+  const auto timeOffset = fTimeOffset;
+  TRACE_THREAD_NAME("Readout" + std::to_string(fModNo));
 
   while (fRunning) {
+    auto timeOut = GetReadTimeOut(eventBuffer, TPipelineStats::Now());
     auto err = CAEN_FELib_ReadData(
-        fReadDataHandle, fTimeOut, &eventData.channel, &eventData.timeStamp,
+        fReadDataHandle, timeOut, &eventData.channel, &eventData.timeStamp,
         &eventData.timeStampNs, &eventData.energy, &eventData.energyShort,
         &eventData.flags, eventData.analogProbe1.data(),
         &eventData.analogProbe1Type, eventData.analogProbe2.data(),
-        &eventData.analogProbe2Type, eventData.digitalProbe1.data(),
-        &eventData.digitalProbe1Type, eventData.digitalProbe2.data(),
+        &eventData.analogProbe2Type, digitalProbe1.data(),
+        &eventData.digitalProbe1Type, digitalProbe2.data(),
         &eventData.digitalProbe2Type, &eventData.waveformSize,
         &eventData.eventSize);
+    nCalls++;
+    if (err == CAEN_FELib_Timeout) nTimeouts++;
     if (err == CAEN_FELib_Success && eventData.energy > 0) {
-      eventBuffer.emplace_back(std::make_unique<TEventData>(eventData));
+      eventData.timeStampNs += timeOffset;
+      PushEvent(eventData, digitalProbe1, digitalProbe2, eventBuffer);
     }
 
-    if (eventBuffer.size() > fEventThreshold || err != CAEN_FELib_Success) {
-      std::lock_guard<std::mutex> lock(fEventsDataMutex);
-      fEventsVec->insert(fEventsVec->end(),
-                         std::make_move_iterator(eventBuffer.begin()),
-                         std::make_move_iterator(eventBuffer.end()));
-      eventBuffer.clear();
+    auto failed = err != CAEN_FELib_Success && err != CAEN_FELib_Timeout;
+    if (failed || IsBatchDue(eventBuffer, maxEvents, TPipelineStats::Now())) {
+      FlushEvents(eventBuffer, nCalls, nTimeouts);
     }
   }
 
-  std::lock_guard<std::mutex> lock(fEventsDataMutex);
-  fEventsVec->insert(fEventsVec->end(),
-                     std::make_move_iterator(eventBuffer.begin()),
-                     std::make_move_iterator(eventBuffer.end()));
-  eventBuffer.clear();
+  FlushEvents(eventBuffer, nCalls, nTimeouts);
 }
 
 void TDigitizer::FetchEventsPHA()
 {
+  // Before allocating, so the buffers are on the node of the thread
+  TThreadAffinity::GetInstance().ApplyReadout(fModNo);
   std::string buf;
   GetParameter("/par/reclen", buf);
   const auto recLen = static_cast<uint32_t>(std::stoi(buf));
   TEventData eventData(recLen);
   eventData.module = fModNo;
   eventData.energyShort = 0;
+  std::vector<uint8_t> digitalProbe1(recLen);
+  std::vector<uint8_t> digitalProbe2(recLen);
+  const auto maxEvents = GetMaxBatchEvents(recLen);
   std::vector<std::unique_ptr<TEventData>> eventBuffer;
-  eventBuffer.reserve(10000);
+  eventBuffer.reserve(maxEvents);
+  uint64_t nCalls = 0;
+  uint64_t nTimeouts = 0;
+  const auto timeOffset = fTimeOffset;
+  TRACE_THREAD_NAME("Readout" + std::to_string(fModNo));
 
   while (fRunning) {
+    auto timeOut = GetReadTimeOut(eventBuffer, TPipelineStats::Now());
     auto err = CAEN_FELib_ReadData(
-        fReadDataHandle, fTimeOut, &eventData.channel, &eventData.timeStamp,
+        fReadDataHandle, timeOut, &eventData.channel, &eventData.timeStamp,
         &eventData.timeStampNs, &eventData.energy, &eventData.flags,
         eventData.analogProbe1.data(), &eventData.analogProbe1Type,
         eventData.analogProbe2.data(), &eventData.analogProbe2Type,
-        eventData.digitalProbe1.data(), &eventData.digitalProbe1Type,
-        eventData.digitalProbe2.data(), &eventData.digitalProbe2Type,
+        digitalProbe1.data(), &eventData.digitalProbe1Type,
+        digitalProbe2.data(), &eventData.digitalProbe2Type,
         &eventData.waveformSize, &eventData.eventSize);
+    nCalls++;
+    if (err == CAEN_FELib_Timeout) nTimeouts++;
     if (err == CAEN_FELib_Success && eventData.energy > 0) {
-      eventBuffer.emplace_back(std::make_unique<TEventData>(eventData));
+      eventData.timeStampNs += timeOffset;
+      PushEvent(eventData, digitalProbe1, digitalProbe2, eventBuffer);
     }
 
-    if (eventBuffer.size() > fEventThreshold || err != CAEN_FELib_Success) {
-      std::lock_guard<std::mutex> lock(fEventsDataMutex);
-      fEventsVec->insert(fEventsVec->end(),
-                         std::make_move_iterator(eventBuffer.begin()),
-                         std::make_move_iterator(eventBuffer.end()));
-      eventBuffer.clear();
+    auto failed = err != CAEN_FELib_Success && err != CAEN_FELib_Timeout;
+    if (failed || IsBatchDue(eventBuffer, maxEvents, TPipelineStats::Now())) {
+      FlushEvents(eventBuffer, nCalls, nTimeouts);
     }
   }
 
-  std::lock_guard<std::mutex> lock(fEventsDataMutex);
-  fEventsVec->insert(fEventsVec->end(),
-                     std::make_move_iterator(eventBuffer.begin()),
-                     std::make_move_iterator(eventBuffer.end()));
-  eventBuffer.clear();
+  FlushEvents(eventBuffer, nCalls, nTimeouts);
 }
 
 void TDigitizer::FetchEventsScope()
 {
+  // Before allocating, so the buffers are on the node of the thread
+  TThreadAffinity::GetInstance().ApplyReadout(fModNo);
   std::string buf;
   GetParameter("/par/reclen", buf);
   const auto recLen = static_cast<uint32_t>(std::stoi(buf));
@@ -285,8 +588,13 @@ void TDigitizer::FetchEventsScope()
   eventData.module = fModNo;
   eventData.energy = 0;
   eventData.energyShort = 0;
+  const auto maxEvents = GetMaxBatchEvents(recLen);
   std::vector<std::unique_ptr<TEventData>> eventBuffer;
-  eventBuffer.reserve(10000);
+  eventBuffer.reserve(maxEvents);
+  uint64_t nCalls = 0;
+  uint64_t nTimeouts = 0;
+  const auto timeOffset = fTimeOffset;
+  TRACE_THREAD_NAME("Readout" + std::to_string(fModNo));
 
   uint64_t timeStamp;
   uint64_t timeStampNs;
@@ -305,26 +613,29 @@ void TDigitizer::FetchEventsScope()
   uint32_t eventSize;
 
   while (fRunning) {
+    auto timeOut = GetReadTimeOut(eventBuffer, TPipelineStats::Now());
     int err = CAEN_FELib_ReadData(
-        fReadDataHandle, fTimeOut, &timeStamp, &timeStampNs, &triggerID,
+        fReadDataHandle, timeOut, &timeStamp, &timeStampNs, &triggerID,
         waveform, &waveformSize[0], &extra, &boardID, &boardFail, &eventSize);
+    nCalls++;
+    if (err == CAEN_FELib_Timeout) nTimeouts++;
     if (err == CAEN_FELib_Success) {
+      eventData.readoutTime = TPipelineStats::Now();
       for (uint8_t iCh = 0; iCh < nChs; iCh++) {
         eventData.channel = iCh;
         eventData.timeStamp = timeStamp;
-        eventData.timeStampNs = static_cast<double>(timeStampNs);  // dangerous
+        eventData.timeStampNs =
+            static_cast<double>(timeStampNs) + timeOffset;  // dangerous
+        eventData.waveformSize = waveformSize[iCh];
         eventData.analogProbe1 =
             std::vector<int16_t>(waveform[iCh], waveform[iCh] + recLen);
         eventBuffer.emplace_back(std::make_unique<TEventData>(eventData));
       }
     }
 
-    if (eventBuffer.size() > fEventThreshold || err != CAEN_FELib_Success) {
-      std::lock_guard<std::mutex> lock(fEventsDataMutex);
-      fEventsVec->insert(fEventsVec->end(),
-                         std::make_move_iterator(eventBuffer.begin()),
-                         std::make_move_iterator(eventBuffer.end()));
-      eventBuffer.clear();
+    auto failed = err != CAEN_FELib_Success && err != CAEN_FELib_Timeout;
+    if (failed || IsBatchDue(eventBuffer, maxEvents, TPipelineStats::Now())) {
+      FlushEvents(eventBuffer, nCalls, nTimeouts);
     }
   }
 
@@ -333,25 +644,64 @@ void TDigitizer::FetchEventsScope()
   }
   delete[] waveform;
 
+  FlushEvents(eventBuffer, nCalls, nTimeouts);
+}
+
+uint32_t TDigitizer::GetMaxBatchEvents(uint32_t recLen) const
+{
+  // A TEventData copy holds the full record length of every probe
+  const auto eventBytes = sizeof(TEventData) + 2 * recLen * sizeof(int16_t) +
+                          2 * DigitalProbeWords(recLen) * sizeof(uint64_t);
+  return std::max<uint64_t>(1, fTargetBatchBytes / eventBytes);
+}
+
+int32_t TDigitizer::GetReadTimeOut(
+    const std::vector<std::unique_ptr<TEventData>> &buf, uint64_t now) const
+{
+  if (buf.empty()) return fTimeOut;
+  const auto age = (now - buf.front()->readoutTime) * 1.e-6;  // ms
+  const auto remaining = std::max(0., fTargetLatency - age);
+  return std::min(fTimeOut, static_cast<int32_t>(std::ceil(remaining)));
+}
+
+bool TDigitizer::IsBatchDue(const std::vector<std::unique_ptr<TEventData>> &buf,
+                            uint32_t maxEvents, uint64_t now) const
+{
+  if (buf.empty()) return false;
+  if (buf.size() >= maxEvents) return true;
+  return (now - buf.front()->readoutTime) * 1.e-6 >= fTargetLatency;
+}
+
+void TDigitizer::FlushEvents(std::vector<std::unique_ptr<TEventData>> &buf,
+                             uint64_t &nCalls, uint64_t &nTimeouts)
+{
+  TRACE_SCOPE("Flush");
+  auto &stats = TPipelineStats::GetInstance();
+  stats.RecordReadout(fModNo, nCalls, nTimeouts, buf.size());
+  nCalls = nTimeouts = 0;
+  if (buf.empty()) return;
+
+  stats.RecordBatch(PipelineStage::DigitizerBuffer, buf);
   std::lock_guard<std::mutex> lock(fEventsDataMutex);
-  fEventsVec->insert(fEventsVec->end(),
-                     std::make_move_iterator(eventBuffer.begin()),
-                     std::make_move_iterator(eventBuffer.end()));
-  eventBuffer.clear();
+  fEventsVec->insert(fEventsVec->end(), std::make_move_iterator(buf.begin()),
+                     std::make_move_iterator(buf.end()));
+  buf.clear();
 }
 
 std::unique_ptr<DAQData_t> TDigitizer::GetEvents()
 {
   std::lock_guard<std::mutex> lock(fEventsDataMutex);
   auto buf = std::move(fEventsVec);
+  fLastEventsSize = buf->size();
   MakeNewEventsVec();
   return buf;
 }
 
 void TDigitizer::MakeNewEventsVec()
 {
+  // Sized like the last one, GetEvents is polled every few ms
   fEventsVec = std::make_unique<DAQData_t>();
-  fEventsVec->reserve(1024 * 1024);
+  fEventsVec->reserve(fLastEventsSize);
 }
 
 void TDigitizer::CheckError(int err) const
@@ -0,0 +1,119 @@
+#include "TEnergyCalibrator.hpp"
+
+#include <cmath>
+#include <iostream>
+
+TEnergyCalibrator::TEnergyCalibrator()
+{
+  fTrackedPeak = std::make_unique<std::atomic<float>[]>(1 << 16);
+  for (auto i = 0U; i < (1 << 16); i++) fTrackedPeak[i] = 0.f;
+  fGainCorrection.assign(1 << 16, 1.f);
+  fCalibrationIndex.Assign(AddCalibration(nlohmann::json::object()));
+}
+
+TEnergyCalibrator::~TEnergyCalibrator() {}
+
+uint16_t TEnergyCalibrator::AddCalibration(const nlohmann::json &conf)
+{
+  // Identity when nothing is given
+  auto coefficients =
+      conf.value("Coefficients", std::vector<float>{0.f, 1.f});
+  if (coefficients.size() > kNCoefficients) {
+    std::cerr << "Calibration polynomial is limited to order "
+              << kNCoefficients - 1 << std::endl;
+  }
+  coefficients.resize(kNCoefficients, 0.f);
+  for (auto i = 0U; i < kNCoefficients; i++)
+    fCoefficients[i].push_back(coefficients[i]);
+
+  fPeakPosition.push_back(conf.value("PeakPosition", 0.f));
+  fPeakWindow.push_back(conf.value("PeakWindow", 0.f));
+  return fPeakPosition.size() - 1;
+}
+
+void TEnergyCalibrator::LoadConf(const nlohmann::json &conf)
+{
+  // Calibration by channel as in TChannelSettings
+  fDriftCorrection = conf.value("DriftCorrection", fDriftCorrection);
+  fTrackingAlpha = conf.value("TrackingAlpha", fTrackingAlpha);
+
+  for (auto &coefficients : fCoefficients) coefficients.clear();
+  fPeakPosition.clear();
+  fPeakWindow.clear();
+
+  fCalibrationIndex.Load(conf, [this](const nlohmann::json &channelConf) {
+    return AddCalibration(channelConf);
+  });
+
+  for (auto i = 0U; i < (1 << 16); i++) fTrackedPeak[i] = 0.f;
+  fGainCorrection.assign(1 << 16, 1.f);
+}
+
+float TEnergyCalibrator::GetRelativeGain(uint32_t module,
+                                         uint32_t channel) const
+{
+  if (module > 255 || channel > 255) return 0.f;
+  const auto id = (module << 8) | channel;
+  const auto position = fPeakPosition[fCalibrationIndex[id]];
+  if (position <= 0.f) return 0.f;
+  return fTrackedPeak[id].load(std::memory_order_relaxed) / position;
+}
+
+void TEnergyCalibrator::TrackPeaks(uint32_t n)
+{
+  // Serial, a channel can appear many times in a batch
+  for (auto i = 0U; i < n; i++) {
+    const auto calib = fCalibration[i];
+    const auto position = fPeakPosition[calib];
+    if (position <= 0.f) continue;
+
+    // The window follows the line once it is found, so a drift larger than
+    // the window is still tracked
+    const auto id = fID[i];
+    auto peak = fTrackedPeak[id].load(std::memory_order_relaxed);
+    const auto centre = peak > 0.f ? peak : position;
+    const auto e = fEnergy[i];
+    if (std::abs(e - centre) > fPeakWindow[calib]) continue;
+
+    peak = peak > 0.f ? peak + fTrackingAlpha * (e - peak) : e;
+    fTrackedPeak[id].store(peak, std::memory_order_relaxed);
+    if (fDriftCorrection) fGainCorrection[id] = position / peak;
+  }
+}
+
+void TEnergyCalibrator::Process(DAQData_t &data)
+{
+  const auto n = static_cast<uint32_t>(data.size());
+  fEnergy.resize(n);
+  fCalibration.resize(n);
+  fID.resize(n);
+  fEnergyCal.resize(n);
+
+  for (auto i = 0U; i < n; i++) {
+    const auto &event = data[i];
+    fEnergy[i] = event->energy;
+    fID[i] = (event->module << 8) | event->channel;
+    fCalibration[i] = fCalibrationIndex[fID[i]];
+  }
+
+  TrackPeaks(n);
+
+  const auto *energy = fEnergy.data();
+  const auto *calib = fCalibration.data();
+  const auto *id = fID.data();
+  const auto *gain = fGainCorrection.data();
+  const auto *c0 = fCoefficients[0].data();
+  const auto *c1 = fCoefficients[1].data();
+  const auto *c2 = fCoefficients[2].data();
+  const auto *c3 = fCoefficients[3].data();
+  auto *energyCal = fEnergyCal.data();
+
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    const auto c = calib[i];
+    const auto x = energy[i] * gain[id[i]];
+    energyCal[i] = ((c3[c] * x + c2[c]) * x + c1[c]) * x + c0[c];
+  }
+
+  for (auto i = 0U; i < n; i++) data[i]->energyCal = fEnergyCal[i];
+}
@@ -0,0 +1,159 @@
+#include "TEventFilter.hpp"
+
+#include <fstream>
+#include <iostream>
+
+TEventFilter::TEventFilter()
+{
+  fCutIndex.Assign(AddCut(Cut()));
+  fKernel = &TEventFilter::EvaluateColumns<false, false, false>;
+}
+
+TEventFilter::~TEventFilter() {}
+
+TEventFilter::Cut TEventFilter::ParseCut(const nlohmann::json &conf,
+                                         const Cut &base)
+{
+  auto cut = base;
+  cut.energyMin = conf.value("EnergyMin", cut.energyMin);
+  cut.energyMax = conf.value("EnergyMax", cut.energyMax);
+  cut.psdMin = conf.value("PSDMin", cut.psdMin);
+  cut.psdMax = conf.value("PSDMax", cut.psdMax);
+  cut.requireFlags = conf.value("RequireFlags", cut.requireFlags);
+  cut.rejectFlags = conf.value("RejectFlags", cut.rejectFlags);
+  cut.requireHWFlags = conf.value("RequireHWFlags", cut.requireHWFlags);
+  cut.rejectHWFlags = conf.value("RejectHWFlags", cut.rejectHWFlags);
+  return cut;
+}
+
+uint16_t TEventFilter::AddCut(const Cut &cut)
+{
+  fEnergyMin.push_back(cut.energyMin);
+  fEnergyMax.push_back(cut.energyMax);
+  fPSDMin.push_back(cut.psdMin);
+  fPSDMax.push_back(cut.psdMax);
+  fRequireFlags.push_back(cut.requireFlags);
+  fRejectFlags.push_back(cut.rejectFlags);
+  fRequireHWFlags.push_back(cut.requireHWFlags);
+  fRejectHWFlags.push_back(cut.rejectHWFlags);
+  return fEnergyMin.size() - 1;
+}
+
+void TEventFilter::LoadConf(const std::string &fileName)
+{
+  std::ifstream fin(fileName);
+  if (!fin) {
+    std::cerr << "Filter configuration " << fileName << " not found"
+              << std::endl;
+    exit(1);
+  }
+  nlohmann::json conf;
+  fin >> conf;
+  fin.close();
+  LoadConf(conf);
+}
+
+void TEventFilter::LoadConf(const nlohmann::json &conf)
+{
+  // Cuts by channel as in TChannelSettings
+  fEnergyMin.clear();
+  fEnergyMax.clear();
+  fPSDMin.clear();
+  fPSDMax.clear();
+  fRequireFlags.clear();
+  fRejectFlags.clear();
+  fRequireHWFlags.clear();
+  fRejectHWFlags.clear();
+
+  fCutIndex.Load(conf, [this](const nlohmann::json &cutConf) {
+    return AddCut(ParseCut(cutConf, Cut()));
+  });
+
+  // Only the cut types somebody uses are evaluated
+  const Cut open;
+  bool useEnergy = false, usePSD = false, useHWFlags = false;
+  fUseQAFlags = false;
+  for (auto i = 0U; i < fEnergyMin.size(); i++) {
+    useEnergy |= fEnergyMin[i] > open.energyMin;
+    useEnergy |= fEnergyMax[i] < open.energyMax;
+    usePSD |= fPSDMin[i] > open.psdMin || fPSDMax[i] < open.psdMax;
+    fUseQAFlags |= fRequireFlags[i] != 0 || fRejectFlags[i] != 0;
+    useHWFlags |= fRequireHWFlags[i] != 0 || fRejectHWFlags[i] != 0;
+  }
+  const bool useFlags = fUseQAFlags || useHWFlags;
+
+  static constexpr Kernel_t kernels[8] = {
+      &TEventFilter::EvaluateColumns<false, false, false>,
+      &TEventFilter::EvaluateColumns<false, false, true>,
+      &TEventFilter::EvaluateColumns<false, true, false>,
+      &TEventFilter::EvaluateColumns<false, true, true>,
+      &TEventFilter::EvaluateColumns<true, false, false>,
+      &TEventFilter::EvaluateColumns<true, false, true>,
+      &TEventFilter::EvaluateColumns<true, true, false>,
+      &TEventFilter::EvaluateColumns<true, true, true>};
+  fKernel = kernels[(useEnergy << 2) | (usePSD << 1) | useFlags];
+
+  std::cout << "Filter: " << fEnergyMin.size() << " cuts"
+            << (useEnergy ? ", energy" : "") << (usePSD ? ", PSD" : "")
+            << (useFlags ? ", flags" : "") << std::endl;
+}
+
+template <bool kEnergy, bool kPSD, bool kFlags>
+void TEventFilter::EvaluateColumns(uint32_t n, uint8_t *pass) const
+{
+  const auto *energy = fEnergy.data();
+  const auto *psd = fPSD.data();
+  const auto *flags = fFlags.data();
+  const auto *hwFlags = fHWFlags.data();
+  const auto *cut = fCut.data();
+
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    bool accept = true;
+    if constexpr (kEnergy) {
+      accept &= energy[i] >= fEnergyMin[cut[i]];
+      accept &= energy[i] <= fEnergyMax[cut[i]];
+    }
+    if constexpr (kPSD) {
+      accept &= psd[i] >= fPSDMin[cut[i]];
+      accept &= psd[i] <= fPSDMax[cut[i]];
+    }
+    if constexpr (kFlags) {
+      const auto require = fRequireFlags[cut[i]];
+      accept &= (flags[i] & require) == require;
+      accept &= (flags[i] & fRejectFlags[cut[i]]) == 0;
+      const auto requireHW = fRequireHWFlags[cut[i]];
+      accept &= (hwFlags[i] & requireHW) == requireHW;
+      accept &= (hwFlags[i] & fRejectHWFlags[cut[i]]) == 0;
+    }
+    pass[i] = accept;
+  }
+}
+
+void TEventFilter::Evaluate(const DAQData_t &data, std::vector<uint8_t> &pass)
+{
+  const auto n = static_cast<uint32_t>(data.size());
+  pass.resize(n);
+  fEnergy.resize(n);
+  fPSD.resize(n);
+  fFlags.resize(n);
+  fHWFlags.resize(n);
+  fCut.resize(n);
+
+  for (auto i = 0U; i < n; i++) {
+    const auto &event = data[i];
+    fEnergy[i] = event->energy;
+    fPSD[i] = PSDRatio(event->energy, event->energyShort);
+    fFlags[i] = event->qaFlags;
+    fHWFlags[i] = event->flags;
+    fCut[i] = fCutIndex[(event->module << 8) | event->channel];
+  }
+
+  (this->*fKernel)(n, pass.data());
+
+  auto nAccepted = 0U;
+#pragma omp simd reduction(+ : nAccepted)
+  for (auto i = 0U; i < n; i++) nAccepted += pass[i];
+  fNAccepted += nAccepted;
+  fNRejected += n - nAccepted;
+}
@@ -0,0 +1,90 @@
+#include "TLatencyHistogram.hpp"
+
+TLatencyHistogram::TLatencyHistogram() { Reset(); }
+
+TLatencyHistogram::~TLatencyHistogram() {}
+
+uint32_t TLatencyHistogram::GetBucketIndex(uint64_t value)
+{
+  if (value < kSubBuckets) return static_cast<uint32_t>(value);
+
+  const uint32_t msb = 63 - __builtin_clzll(value);
+  const uint32_t shift = msb - kSubBucketBits;
+  const uint32_t sub = (value >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub;
+}
+
+uint64_t TLatencyHistogram::GetBucketLowEdge(uint32_t index)
+{
+  const uint32_t major = index / kSubBuckets;
+  const uint64_t sub = index % kSubBuckets;
+  if (major == 0) return sub;
+  return (kSubBuckets + sub) << (major - 1);
+}
+
+uint64_t TLatencyHistogram::GetBucketCount(uint32_t index) const
+{
+  if (index >= kNBuckets) return 0;
+  return fCounts[index].load(std::memory_order_relaxed);
+}
+
+void TLatencyHistogram::Record(uint64_t value)
+{
+  fCounts[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  fTotalCount.fetch_add(1, std::memory_order_relaxed);
+  fSum.fetch_add(value, std::memory_order_relaxed);
+
+  auto max = fMax.load(std::memory_order_relaxed);
+  while (value > max &&
+         !fMax.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void TLatencyHistogram::Reset()
+{
+  for (auto &count : fCounts) count.store(0, std::memory_order_relaxed);
+  fTotalCount.store(0, std::memory_order_relaxed);
+  fSum.store(0, std::memory_order_relaxed);
+  fMax.store(0, std::memory_order_relaxed);
+}
+
+uint64_t TLatencyHistogram::GetCount() const
+{
+  return fTotalCount.load(std::memory_order_relaxed);
+}
+
+uint64_t TLatencyHistogram::GetMax() const
+{
+  return fMax.load(std::memory_order_relaxed);
+}
+
+double TLatencyHistogram::GetMean() const
+{
+  auto count = GetCount();
+  if (count == 0) return 0.;
+  return static_cast<double>(fSum.load(std::memory_order_relaxed)) / count;
+}
+
+uint64_t TLatencyHistogram::GetPercentile(double percentile) const
+{
+  auto count = GetCount();
+  if (count == 0) return 0;
+
+  // Rank of the requested percentile, at least the first entry
+  auto rank = static_cast<uint64_t>(percentile / 100. * count + 0.5);
+  if (rank < 1) rank = 1;
+
+  uint64_t sum = 0;
+  for (auto i = 0U; i < kNBuckets; i++) {
+    sum += fCounts[i].load(std::memory_order_relaxed);
+    if (sum >= rank) {
+      // Upper edge of the bucket, never above the recorded maximum
+      auto upper = (i + 1 < kNBuckets) ? GetBucketLowEdge(i + 1) - 1
+                                       : GetBucketLowEdge(i);
+      auto max = GetMax();
+      return upper < max ? upper : max;
+    }
+  }
+
+  return GetMax();
+}
@@ -0,0 +1,150 @@
+#include "TNoiseSpectrum.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "TTrace.hpp"
+#include "TWaveformDSP.hpp"
+
+TNoiseSpectrum::TNoiseSpectrum(uint32_t nSamples, uint32_t decimation,
+                               const TChannelMap &channelMap,
+                               const std::vector<uint32_t> &preTrigger)
+    : fNSamples(nSamples),
+      fDecimation(std::max(1U, decimation)),
+      fNChannels(channelMap.GetNChannels())
+{
+  if (fNSamples < 2 || (fNSamples & (fNSamples - 1)) != 0) {
+    std::cerr << "Noise spectrum samples must be a power of 2, using 64"
+              << std::endl;
+    fNSamples = 64;
+  }
+
+  fUsable.assign(fNChannels, 1);
+  for (auto iMod = 0U; iMod < channelMap.GetNModules(); iMod++) {
+    if (iMod >= preTrigger.size() || preTrigger[iMod] == 0) continue;
+    if (preTrigger[iMod] >= fNSamples) continue;
+    std::cout << "Module " << int(channelMap.GetModuleID(iMod))
+              << ": pre-trigger " << preTrigger[iMod]
+              << " samples, no noise spectra" << std::endl;
+    const auto offset = channelMap.GetOffset(iMod);
+    for (auto iCh = 0U; iCh < channelMap.GetNChannels(iMod); iCh++)
+      fUsable[offset + iCh] = 0;
+  }
+
+  fCounter = std::make_unique<std::atomic<uint32_t>[]>(fNChannels);
+  for (auto i = 0U; i < fNChannels; i++) fCounter[i] = 0;
+  fSum.assign(fNChannels, std::vector<double>(GetNBins(), 0.));
+  fNSpectra.assign(fNChannels, 0);
+
+  // Hann window
+  fWindow.resize(fNSamples);
+  fWindowNorm = 0.f;
+  for (auto i = 0U; i < fNSamples; i++) {
+    fWindow[i] = 0.5f - 0.5f * std::cos(2. * M_PI * i / fNSamples);
+    fWindowNorm += fWindow[i] * fWindow[i];
+  }
+  fCos.resize(fNSamples / 2);
+  fSin.resize(fNSamples / 2);
+  TWaveformDSP::FFTTables(fNSamples, fCos.data(), fSin.data());
+}
+
+TNoiseSpectrum::~TNoiseSpectrum() { Stop(); }
+
+void TNoiseSpectrum::Start()
+{
+  if (fRunning) return;
+  fRunning = true;
+  fWorker = std::thread(&TNoiseSpectrum::WorkerThread, this);
+}
+
+void TNoiseSpectrum::Stop()
+{
+  if (!fRunning) return;
+  fRunning = false;
+  fQueueCV.notify_all();
+  fWorker.join();
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  fQueue.clear();
+}
+
+void TNoiseSpectrum::Offer(uint32_t index, const int16_t *wf, std::size_t n)
+{
+  if (n < fNSamples || index >= fNChannels || !fUsable[index]) return;
+  if (fCounter[index].fetch_add(1, std::memory_order_relaxed) % fDecimation)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(fQueueMutex);
+    if (fQueue.size() >= kMaxQueue) return;
+    fQueue.push_back({index, std::vector<int16_t>(wf, wf + fNSamples)});
+  }
+  fQueueCV.notify_one();
+}
+
+uint64_t TNoiseSpectrum::GetAverage(uint32_t index, std::vector<double> &power)
+{
+  power.assign(GetNBins(), 0.);
+  if (index >= fNChannels) return 0;
+  std::lock_guard<std::mutex> lock(fSumMutex);
+  const auto n = fNSpectra[index];
+  if (n == 0) return 0;
+  for (auto i = 0U; i < GetNBins(); i++) power[i] = fSum[index][i] / n;
+  return n;
+}
+
+void TNoiseSpectrum::Reset()
+{
+  std::lock_guard<std::mutex> lock(fSumMutex);
+  for (auto &sum : fSum) std::fill(sum.begin(), sum.end(), 0.);
+  std::fill(fNSpectra.begin(), fNSpectra.end(), 0);
+}
+
+void TNoiseSpectrum::WorkerThread()
+{
+  // Only runs when a CPU has nothing else to do
+  sched_param param{};
+  param.sched_priority = 0;
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  TRACE_THREAD_NAME("NoiseSpectrum");
+
+  std::vector<float> re(fNSamples);
+  std::vector<float> im(fNSamples);
+  std::vector<double> power(GetNBins());
+  while (fRunning) {
+    Trace trace;
+    {
+      std::unique_lock<std::mutex> lock(fQueueMutex);
+      fQueueCV.wait_for(lock, std::chrono::milliseconds(100),
+                        [this] { return !fQueue.empty() || !fRunning; });
+      if (fQueue.empty()) continue;
+      trace = std::move(fQueue.front());
+      fQueue.pop_front();
+    }
+
+    TRACE_SCOPE("NoiseFFT");
+    const auto *wf = trace.samples.data();
+    auto mean = TWaveformDSP::Baseline(wf, fNSamples);
+#pragma omp simd
+    for (auto i = 0U; i < fNSamples; i++) {
+      re[i] = (wf[i] - mean) * fWindow[i];
+      im[i] = 0.f;
+    }
+    TWaveformDSP::FFT(re.data(), im.data(), fNSamples, fCos.data(),
+                      fSin.data());
+    // One sided spectrum
+    for (auto i = 0U; i < GetNBins(); i++) {
+      const auto scale = (i == 0 || i == fNSamples / 2) ? 1. : 2.;
+      power[i] = scale * (re[i] * re[i] + im[i] * im[i]) / fWindowNorm;
+    }
+
+    std::lock_guard<std::mutex> lock(fSumMutex);
+    auto &sum = fSum[trace.index];
+    for (auto i = 0U; i < GetNBins(); i++) sum[i] += power[i];
+    fNSpectra[trace.index]++;
+  }
+}
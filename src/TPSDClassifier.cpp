@@ -0,0 +1,146 @@
+#include "TPSDClassifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+TPSDClassifier::TPSDClassifier() {}
+
+TPSDClassifier::~TPSDClassifier() {}
+
+uint32_t TPSDClassifier::RasterisePolygon(
+    const std::vector<std::vector<float>> &vertices)
+{
+  const auto offset = static_cast<uint32_t>(fMaps.size());
+  fMaps.resize(offset + fMapBins * fMapBins, 0);
+  const auto nVertices = vertices.size();
+  const auto binE = fMapEnergyMax / fMapBins;
+  const auto binPSD = (fMapPSDMax - fMapPSDMin) / fMapBins;
+
+  // Crossing number at the centre of each cell
+  for (auto iy = 0U; iy < fMapBins; iy++) {
+    const auto y = fMapPSDMin + (iy + 0.5f) * binPSD;
+    for (auto ix = 0U; ix < fMapBins; ix++) {
+      const auto x = (ix + 0.5f) * binE;
+      bool inside = false;
+      for (std::size_t i = 0, j = nVertices - 1; i < nVertices; j = i++) {
+        const auto &a = vertices[i];
+        const auto &b = vertices[j];
+        if ((a[1] > y) != (b[1] > y) &&
+            x < (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]) + a[0])
+          inside = !inside;
+      }
+      fMaps[offset + iy * fMapBins + ix] = inside;
+    }
+  }
+  return offset;
+}
+
+uint16_t TPSDClassifier::AddCut(const nlohmann::json &conf)
+{
+  auto type = CutType::None;
+  auto params = std::vector<float>{0.f, 0.f, 0.f};
+  uint32_t mapOffset = 0;
+
+  auto typeName = conf.value("Type", std::string("None"));
+  if (typeName == "Boundary") {
+    type = CutType::Boundary;
+    params = conf.value("Parameters", params);
+    params.resize(3, 0.f);
+  } else if (typeName == "Polygon") {
+    auto vertices =
+        conf.value("Vertices", std::vector<std::vector<float>>());
+    if (vertices.size() < 3 ||
+        std::any_of(vertices.begin(), vertices.end(),
+                    [](const auto &v) { return v.size() != 2; })) {
+      std::cerr << "PSD polygon needs at least 3 [ChargeLong, PSD] vertices"
+                << std::endl;
+    } else {
+      type = CutType::Polygon;
+      mapOffset = RasterisePolygon(vertices);
+    }
+  } else if (typeName != "None") {
+    std::cerr << "Unknown PSD cut type " << typeName << std::endl;
+  }
+
+  fType.push_back(static_cast<uint8_t>(type));
+  fEnergyMin.push_back(conf.value("EnergyMin", 0.f));
+  fP0.push_back(params[0]);
+  fP1.push_back(params[1]);
+  fP2.push_back(params[2]);
+  fMapOffset.push_back(mapOffset);
+  return fType.size() - 1;
+}
+
+void TPSDClassifier::LoadConf(const nlohmann::json &conf)
+{
+  // Cuts by channel as in TChannelSettings
+  fMapBins = conf.value("MapBins", fMapBins);
+  fMapEnergyMax = conf.value("MapEnergyMax", fMapEnergyMax);
+  fMapPSDMin = conf.value("MapPSDMin", fMapPSDMin);
+  fMapPSDMax = conf.value("MapPSDMax", fMapPSDMax);
+
+  fType.clear();
+  fEnergyMin.clear();
+  fP0.clear();
+  fP1.clear();
+  fP2.clear();
+  fMapOffset.clear();
+  fMaps.assign(fMapBins * fMapBins, 0);
+
+  fCutIndex.Load(conf, [this](const nlohmann::json &cutConf) {
+    return AddCut(cutConf);
+  });
+}
+
+void TPSDClassifier::Process(DAQData_t &data)
+{
+  const auto n = static_cast<uint32_t>(data.size());
+  fEnergy.resize(n);
+  fPSD.resize(n);
+  fCut.resize(n);
+  fClass.resize(n);
+
+  for (auto i = 0U; i < n; i++) {
+    const auto &event = data[i];
+    fEnergy[i] = event->energy;
+    fPSD[i] = PSDRatio(event->energy, event->energyShort);
+    fCut[i] = fCutIndex[(event->module << 8) | event->channel];
+  }
+
+  const auto *energy = fEnergy.data();
+  const auto *psd = fPSD.data();
+  const auto *cut = fCut.data();
+  auto *cls = fClass.data();
+  const auto *maps = fMaps.data();
+  const auto nBins = static_cast<int32_t>(fMapBins);
+  const auto scaleE = fMapBins / fMapEnergyMax;
+  const auto scalePSD = fMapBins / (fMapPSDMax - fMapPSDMin);
+  constexpr auto kBoundary = static_cast<uint8_t>(CutType::Boundary);
+  constexpr auto kPolygon = static_cast<uint8_t>(CutType::Polygon);
+
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    const auto c = cut[i];
+    const auto e = std::max(energy[i], 1.f);
+
+    const auto boundary = fP0[c] + fP1[c] / std::sqrt(e) + fP2[c] / e;
+    const bool aboveBoundary = psd[i] >= boundary;
+
+    const auto x = static_cast<int32_t>(energy[i] * scaleE);
+    // Below MapPSDMin would truncate into bin 0
+    const auto y = static_cast<int32_t>((psd[i] - fMapPSDMin) * scalePSD);
+    const bool inMap =
+        x >= 0 && x < nBins && psd[i] >= fMapPSDMin && y < nBins;
+    const bool inPolygon =
+        inMap && maps[fMapOffset[c] + (inMap ? y * nBins + x : 0)];
+
+    const auto type = fType[c];
+    const bool neutron =
+        (type == kBoundary && aboveBoundary) || (type == kPolygon && inPolygon);
+    const bool known = type != 0 && energy[i] >= fEnergyMin[c];
+    cls[i] = known ? (neutron ? kClassNeutron : kClassGamma) : kClassUnknown;
+  }
+
+  for (auto i = 0U; i < n; i++) data[i]->particleClass = fClass[i];
+}
@@ -0,0 +1,113 @@
+#include "TPipelineStats.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+TPipelineStats::TPipelineStats() {}
+
+TPipelineStats::~TPipelineStats() {}
+
+TPipelineStats &TPipelineStats::GetInstance()
+{
+  static TPipelineStats instance;
+  return instance;
+}
+
+const char *TPipelineStats::GetStageName(PipelineStage stage)
+{
+  switch (stage) {
+    case PipelineStage::DigitizerBuffer:
+      return "DigitizerBuffer";
+    case PipelineStage::Aggregation:
+      return "Aggregation";
+    case PipelineStage::Processing:
+      return "Processing";
+    case PipelineStage::Dispatch:
+      return "Dispatch";
+    case PipelineStage::Conversion:
+      return "Conversion";
+    case PipelineStage::Sort:
+      return "Sort";
+    case PipelineStage::Write:
+      return "Write";
+    case PipelineStage::MonitorFill:
+      return "MonitorFill";
+    default:
+      return "Unknown";
+  }
+}
+
+void TPipelineStats::RecordLatency(PipelineStage stage, uint64_t readoutTime)
+{
+  auto now = Now();
+  fLatency[static_cast<size_t>(stage)].Record(
+      now > readoutTime ? now - readoutTime : 0);
+}
+
+TLatencyHistogram &TPipelineStats::GetLatency(PipelineStage stage)
+{
+  return fLatency[static_cast<size_t>(stage)];
+}
+
+void TPipelineStats::RecordReadout(uint8_t module, uint64_t calls,
+                                   uint64_t timeouts, uint64_t events)
+{
+  auto &readout = fReadout[module];
+  readout.calls += calls;
+  readout.timeouts += timeouts;
+  readout.events += events;
+  if (events > 0) readout.batches++;
+}
+
+void TPipelineStats::Reset()
+{
+  for (auto &latency : fLatency) latency.Reset();
+  for (auto &readout : fReadout) {
+    readout.calls = 0;
+    readout.timeouts = 0;
+    readout.events = 0;
+    readout.batches = 0;
+  }
+}
+
+void TPipelineStats::Print() const
+{
+  std::cout << "Latency from readout (ms)" << std::endl;
+  std::cout << std::setw(16) << "Stage" << std::setw(12) << "Batches"
+            << std::setw(10) << "Mean" << std::setw(10) << "p50"
+            << std::setw(10) << "p99" << std::setw(10) << "Max" << std::endl;
+  for (auto i = 0U; i < kNStages; i++) {
+    const auto &latency = fLatency[i];
+    if (latency.GetCount() == 0) continue;
+    std::cout << std::setw(16) << GetStageName(static_cast<PipelineStage>(i))
+              << std::setw(12) << latency.GetCount() << std::fixed
+              << std::setprecision(2) << std::setw(10)
+              << latency.GetMean() * 1.e-6 << std::setw(10)
+              << latency.GetPercentile(50.) * 1.e-6 << std::setw(10)
+              << latency.GetPercentile(99.) * 1.e-6 << std::setw(10)
+              << latency.GetMax() * 1.e-6 << std::endl;
+  }
+
+  bool header = false;
+  for (auto iMod = 0U; iMod < fReadout.size(); iMod++) {
+    const auto &readout = fReadout[iMod];
+    const uint64_t calls = readout.calls;
+    if (calls == 0) continue;
+    if (!header) {
+      std::cout << "Readout" << std::endl;
+      std::cout << std::setw(16) << "Module" << std::setw(12) << "Calls"
+                << std::setw(10) << "Timeout" << std::setw(10) << "Ev/call"
+                << std::setw(10) << "Ev/batch" << std::endl;
+      header = true;
+    }
+    const double events = readout.events;
+    const auto batches = std::max<uint64_t>(1, readout.batches);
+    std::cout << std::setw(16) << iMod << std::setw(12) << calls << std::fixed
+              << std::setprecision(2) << std::setw(10)
+              << double(readout.timeouts) / calls << std::setw(10)
+              << events / calls << std::setw(10) << events / batches
+              << std::endl;
+  }
+  std::cout.unsetf(std::ios::fixed);
+}
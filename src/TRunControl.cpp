@@ -0,0 +1,155 @@
+#include "TRunControl.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "TTrace.hpp"
+
+TRunControl::TRunControl() {}
+
+TRunControl::~TRunControl() { Stop(); }
+
+void TRunControl::Start(const std::string &fifoName, bool useStdin)
+{
+  if (fListenThread.joinable()) return;
+
+  fFIFOName = fifoName;
+  if (fFIFOName != "") {
+    struct stat st;
+    if (stat(fFIFOName.c_str(), &st) != 0) {
+      if (mkfifo(fFIFOName.c_str(), 0660) != 0) {
+        std::cerr << "mkfifo " << fFIFOName << ": " << strerror(errno)
+                  << std::endl;
+        exit(1);
+      }
+    } else if (!S_ISFIFO(st.st_mode)) {
+      std::cerr << fFIFOName << " exists and is not a FIFO" << std::endl;
+      exit(1);
+    }
+    // Opened read-write, so no POLLHUP when a writer closes
+    fFIFO = open(fFIFOName.c_str(), O_RDWR | O_NONBLOCK);
+    if (fFIFO < 0) {
+      std::cerr << "open " << fFIFOName << ": " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    std::cout << "Run control: " << fFIFOName << std::endl;
+  }
+  fStdin = useStdin ? STDIN_FILENO : -1;
+
+  if (pipe(fWakePipe) != 0) {
+    std::cerr << "pipe: " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  fListenThread = std::thread(&TRunControl::ListenThread, this);
+}
+
+void TRunControl::Stop()
+{
+  if (!fListenThread.joinable()) return;
+
+  char c = 0;
+  if (write(fWakePipe[1], &c, 1) < 0) {
+    std::cerr << "Failed to wake the run control thread" << std::endl;
+  }
+  fListenThread.join();
+
+  for (auto &fd : fWakePipe) {
+    close(fd);
+    fd = -1;
+  }
+  if (fFIFO >= 0) {
+    close(fFIFO);
+    fFIFO = -1;
+  }
+}
+
+bool TRunControl::PopCommand(RunCommand &command, std::string &argument)
+{
+  std::lock_guard<std::mutex> lock(fCommandsMutex);
+  if (fCommands.empty()) return false;
+  command = fCommands.front().first;
+  argument = fCommands.front().second;
+  fCommands.pop_front();
+  return true;
+}
+
+void TRunControl::ListenThread()
+{
+  TRACE_THREAD_NAME("RunControl");
+  std::string fifoLine;
+  std::string stdinLine;
+
+  while (true) {
+    struct pollfd fds[3];
+    fds[0] = {fWakePipe[0], POLLIN, 0};
+    fds[1] = {fFIFO, POLLIN, 0};  // Negative fd is ignored by poll
+    fds[2] = {fStdin, POLLIN, 0};
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "poll: " << strerror(errno) << std::endl;
+      break;
+    }
+    if (fds[0].revents) break;
+
+    auto readLines = [this](int &fd, std::string &line) {
+      char buf[256];
+      auto n = read(fd, buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        fd = -1;  // EOF, e.g. stdin from /dev/null
+        return;
+      }
+      for (auto i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+          ParseLine(line);
+          line.clear();
+        } else {
+          line += buf[i];
+        }
+      }
+    };
+    if (fds[1].revents) readLines(fFIFO, fifoLine);
+    if (fds[2].revents) readLines(fStdin, stdinLine);
+  }
+}
+
+void TRunControl::ParseLine(const std::string &line)
+{
+  std::stringstream ss(line);
+  std::string word;
+  std::string argument;
+  ss >> word;
+  std::getline(ss >> std::ws, argument);
+  if (word == "") return;
+
+  RunCommand command;
+  if (word == "q" || word == "Q" || word == "quit") {
+    command = RunCommand::Quit;
+  } else if (word == "r" || word == "R" || word == "reload") {
+    command = RunCommand::Reload;
+  } else if (word == "t" || word == "T" || word == "trace") {
+    command = RunCommand::DumpTrace;
+  } else if (word == "start") {
+    command = RunCommand::StartRun;
+  } else if (word == "stop") {
+    command = RunCommand::StopRun;
+  } else if (word == "file" && argument != "") {
+    command = RunCommand::FileName;
+  } else {
+    std::cerr << "Unknown command: " << line << std::endl;
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(fCommandsMutex);
+    fCommands.emplace_back(command, argument);
+  }
+  if (fNotify) fNotify();
+}
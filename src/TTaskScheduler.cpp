@@ -0,0 +1,221 @@
+#include "TTaskScheduler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "TThreadAffinity.hpp"
+#include "TTrace.hpp"
+
+namespace
+{
+// Index of the worker running on this thread, -1 for other threads
+thread_local int gWorkerIndex = -1;
+}  // namespace
+
+TTaskScheduler &TTaskScheduler::GetInstance()
+{
+  static TTaskScheduler instance;
+  return instance;
+}
+
+TTaskScheduler::TTaskScheduler()
+{
+  fNThreads = std::max(1U, std::thread::hardware_concurrency());
+}
+
+TTaskScheduler::~TTaskScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(fSleepMutex);
+    fStop = true;
+  }
+  fSleepCV.notify_all();
+  for (auto &thread : fThreads) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+void TTaskScheduler::LoadConf(const nlohmann::json &conf)
+{
+  if (!fThreads.empty()) {
+    std::cerr << "Scheduler is already running, configuration ignored"
+              << std::endl;
+    return;
+  }
+  if (conf.contains("Threads")) {
+    fNThreads = std::max(1U, conf["Threads"].get<uint32_t>());
+  }
+  if (conf.contains("Queues")) fQueueConf = conf["Queues"];
+}
+
+TTaskScheduler::Queue *TTaskScheduler::GetQueue(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(fQueuesMutex);
+  auto &queue = fQueues[name];
+  if (!queue) {
+    queue = std::make_unique<Queue>();
+    queue->fName = name;
+    queue->fMaxConcurrency = fNThreads;
+    if (fQueueConf.contains(name)) {
+      const auto &conf = fQueueConf[name];
+      queue->fMinConcurrency = conf.value("MinConcurrency", 1U);
+      queue->fMaxConcurrency = conf.value("MaxConcurrency", fNThreads);
+      queue->fDepthPerThread = conf.value("QueueDepthPerThread", 1U);
+    }
+    queue->fMinConcurrency = std::max(1U, queue->fMinConcurrency);
+    queue->fMaxConcurrency =
+        std::max(queue->fMinConcurrency, queue->fMaxConcurrency);
+    queue->fDepthPerThread = std::max(1U, queue->fDepthPerThread);
+  }
+  return queue.get();
+}
+
+uint32_t TTaskScheduler::Queue::AllowedConcurrency() const
+{
+  auto allowed = fMinConcurrency + fPending.size() / fDepthPerThread;
+  return std::min<uint64_t>(allowed, fMaxConcurrency);
+}
+
+uint32_t TTaskScheduler::Queue::GetNRunning()
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  return fNRunning;
+}
+
+uint32_t TTaskScheduler::Queue::GetNPending()
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  return fPending.size();
+}
+
+void TTaskScheduler::Submit(Queue *queue, std::function<void()> task)
+{
+  std::call_once(fStartFlag, &TTaskScheduler::StartWorkers, this);
+
+  std::vector<Task> ready;
+  {
+    std::lock_guard<std::mutex> lock(queue->fMutex);
+    queue->fNOutstanding++;
+    queue->fNTasks++;
+    queue->fPending.push_back(std::move(task));
+    while (!queue->fPending.empty() &&
+           queue->fNRunning < queue->AllowedConcurrency()) {
+      ready.push_back({queue, std::move(queue->fPending.front())});
+      queue->fPending.pop_front();
+      queue->fNRunning++;
+    }
+    queue->fPeakRunning = std::max(queue->fPeakRunning, queue->fNRunning);
+  }
+  for (auto &item : ready) PushReady(std::move(item));
+}
+
+void TTaskScheduler::Wait(Queue *queue)
+{
+  std::unique_lock<std::mutex> lock(queue->fMutex);
+  queue->fDoneCV.wait(lock, [queue] { return queue->fNOutstanding == 0; });
+}
+
+void TTaskScheduler::StartWorkers()
+{
+  for (auto i = 0U; i < fNThreads; i++) {
+    fWorkers.push_back(std::make_unique<Worker>());
+  }
+  for (auto i = 0U; i < fNThreads; i++) {
+    fThreads.emplace_back(&TTaskScheduler::WorkerLoop, this, i);
+  }
+}
+
+void TTaskScheduler::PushReady(Task task)
+{
+  // Tasks released by a worker stay on it, the data is still in its cache
+  auto index = gWorkerIndex >= 0 ? uint32_t(gWorkerIndex)
+                                 : fNextWorker.fetch_add(1) % fNThreads;
+  {
+    auto &worker = *fWorkers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    // Counted before it can be stolen, a stealer's decrement must not wrap
+    fNReady++;
+    worker.ready.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(fSleepMutex);
+  }
+  fSleepCV.notify_one();
+}
+
+bool TTaskScheduler::PopTask(uint32_t index, Task &task)
+{
+  // Own tasks in order, then steal the newest of another worker
+  for (auto i = 0U; i < fNThreads; i++) {
+    auto &worker = *fWorkers[(index + i) % fNThreads];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.ready.empty()) continue;
+    if (i == 0) {
+      task = std::move(worker.ready.front());
+      worker.ready.pop_front();
+    } else {
+      task = std::move(worker.ready.back());
+      worker.ready.pop_back();
+    }
+    fNReady--;
+    return true;
+  }
+  return false;
+}
+
+void TTaskScheduler::Finish(Queue *queue)
+{
+  std::vector<Task> ready;
+  bool done = false;
+  {
+    std::lock_guard<std::mutex> lock(queue->fMutex);
+    queue->fNRunning--;
+    queue->fNOutstanding--;
+    while (!queue->fPending.empty() &&
+           queue->fNRunning < queue->AllowedConcurrency()) {
+      ready.push_back({queue, std::move(queue->fPending.front())});
+      queue->fPending.pop_front();
+      queue->fNRunning++;
+    }
+    queue->fPeakRunning = std::max(queue->fPeakRunning, queue->fNRunning);
+    done = queue->fNOutstanding == 0;
+  }
+  for (auto &item : ready) PushReady(std::move(item));
+  if (done) queue->fDoneCV.notify_all();
+}
+
+void TTaskScheduler::WorkerLoop(uint32_t index)
+{
+  gWorkerIndex = index;
+  TRACE_THREAD_NAME("Worker" + std::to_string(index));
+  TThreadAffinity::GetInstance().Apply("Workers");
+  while (true) {
+    Task task;
+    if (!PopTask(index, task)) {
+      std::unique_lock<std::mutex> lock(fSleepMutex);
+      fSleepCV.wait(lock, [this] { return fStop || fNReady > 0; });
+      if (fStop && fNReady == 0) return;
+      continue;
+    }
+
+    try {
+      task.func();
+    } catch (const std::exception &e) {
+      std::cerr << task.queue->GetName() << " task failed: " << e.what()
+                << std::endl;
+    }
+    Finish(task.queue);
+  }
+}
+
+void TTaskScheduler::Print()
+{
+  std::cout << "Scheduler: " << fNThreads << " threads" << std::endl;
+  std::lock_guard<std::mutex> lock(fQueuesMutex);
+  for (auto &[name, queue] : fQueues) {
+    std::lock_guard<std::mutex> queueLock(queue->fMutex);
+    std::cout << "  " << name << ": " << queue->fNTasks << " tasks, peak "
+              << queue->fPeakRunning << " of " << queue->fMaxConcurrency
+              << " concurrent" << std::endl;
+  }
+}
@@ -0,0 +1,139 @@
+#include "TThreadAffinity.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+TThreadAffinity &TThreadAffinity::GetInstance()
+{
+  static TThreadAffinity instance;
+  return instance;
+}
+
+void TThreadAffinity::LoadConf(const nlohmann::json &conf)
+{
+  auto parse = [](const nlohmann::json &spec, const std::string &name) {
+    auto cpus = ParseCPUSet(spec.get<std::string>());
+    if (cpus.empty()) {
+      std::cerr << "Affinity " << name << ": bad CPU set " << spec
+                << ", not pinned" << std::endl;
+    }
+    return cpus;
+  };
+
+  for (auto &item : conf.items()) {
+    if (item.key() == "Readout") {
+      const auto &readout = item.value();
+      if (readout.is_string()) {
+        fReadoutDefault = parse(readout, "Readout");
+        continue;
+      }
+      if (readout.contains("Default")) {
+        fReadoutDefault = parse(readout["Default"], "Readout");
+      }
+      if (readout.contains("Modules")) {
+        for (auto &mod : readout["Modules"].items()) {
+          auto module = std::stoi(mod.key());
+          if (module < 0 || module > 255) {
+            std::cerr << "Affinity: module ID " << mod.key()
+                      << " out of range" << std::endl;
+            continue;
+          }
+          fReadoutCPUs[module] =
+              parse(mod.value(), "Readout module " + mod.key());
+        }
+      }
+    } else {
+      fRoleCPUs[item.key()] = parse(item.value(), item.key());
+    }
+  }
+
+  auto print = [](const std::string &name, const std::vector<int> &cpus) {
+    if (cpus.empty()) return;
+    std::cout << "Affinity " << name << ": " << cpus.size() << " CPUs from "
+              << cpus.front() << ", node " << GetNode(cpus.front())
+              << std::endl;
+  };
+  for (const auto &[role, cpus] : fRoleCPUs) print(role, cpus);
+  print("Readout", fReadoutDefault);
+  for (const auto &[module, cpus] : fReadoutCPUs) {
+    print("Readout module " + std::to_string(module), cpus);
+  }
+}
+
+void TThreadAffinity::Apply(const std::string &role) const
+{
+  auto it = fRoleCPUs.find(role);
+  if (it != fRoleCPUs.end()) Pin(it->second, role);
+}
+
+void TThreadAffinity::ApplyReadout(uint8_t module) const
+{
+  auto it = fReadoutCPUs.find(module);
+  const auto &cpus = it != fReadoutCPUs.end() ? it->second : fReadoutDefault;
+  Pin(cpus, "Readout module " + std::to_string(module));
+}
+
+bool TThreadAffinity::Pin(const std::vector<int> &cpus,
+                          const std::string &name)
+{
+  if (cpus.empty()) return false;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const auto &cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    std::cerr << "Affinity " << name << ": " << strerror(err) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> TThreadAffinity::ParseCPUSet(const std::string &spec)
+{
+  auto list = spec;
+  if (spec.compare(0, 4, "node") == 0) {
+    std::ifstream fin("/sys/devices/system/node/" + spec + "/cpulist");
+    if (!fin || !std::getline(fin, list)) return {};
+  }
+
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    try {
+      std::size_t pos;
+      auto first = std::stoi(range, &pos);
+      auto last = first;
+      if (pos < range.size()) {
+        if (range[pos] != '-') return {};
+        last = std::stoi(range.substr(pos + 1));
+      }
+      if (first < 0 || last < first) return {};
+      for (auto cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      return {};
+    }
+  }
+  return cpus;
+}
+
+int TThreadAffinity::GetNode(int cpu)
+{
+  namespace fs = std::filesystem;
+  const auto dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(dir, ec)) {
+    auto name = entry.path().filename().string();
+    if (name.compare(0, 4, "node") == 0) return std::stoi(name.substr(4));
+  }
+  return -1;
+}
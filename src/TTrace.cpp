@@ -0,0 +1,160 @@
+#include "TTrace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "TPipelineStats.hpp"
+
+TTrace::TTrace() { fOrigin = TPipelineStats::Now(); }
+
+TTrace::~TTrace() {}
+
+TTrace &TTrace::GetInstance()
+{
+  // Never destroyed, worker threads release their buffers during the static
+  // destruction of the other singletons
+  static TTrace *instance = new TTrace;
+  return *instance;
+}
+
+TTrace::BufferHandle::~BufferHandle()
+{
+  if (buffer != nullptr) TTrace::GetInstance().ReleaseBuffer(buffer);
+}
+
+TTrace::BufferHandle &TTrace::GetHandle()
+{
+  thread_local BufferHandle handle;
+  return handle;
+}
+
+TTrace::ThreadBuffer &TTrace::GetThreadBuffer()
+{
+  auto &handle = GetHandle();
+  if (handle.buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(fBuffersMutex);
+    handle.buffer = AcquireBuffer("");
+  }
+  return *handle.buffer;
+}
+
+// Buffers of finished threads are reused by new threads with the same name
+// (e.g. a restarted readout thread continues its track), so their number is
+// bounded by the peak number of concurrent threads of each name rather than
+// by the number of threads ever started.  Caller holds fBuffersMutex.
+TTrace::ThreadBuffer *TTrace::AcquireBuffer(const std::string &name)
+{
+  ThreadBuffer *buffer = nullptr;
+  for (auto &candidate : fBuffers) {
+    if (!candidate->inUse && candidate->name == name) {
+      buffer = candidate.get();
+      break;
+    }
+  }
+
+  if (buffer == nullptr) {
+    auto newBuffer = std::make_unique<ThreadBuffer>();
+    newBuffer->events.resize(kBufferSize);
+    newBuffer->tid = fBuffers.size() + 1;
+    newBuffer->name = name;
+    buffer = newBuffer.get();
+    fBuffers.push_back(std::move(newBuffer));
+  }
+  buffer->inUse = true;
+  return buffer;
+}
+
+void TTrace::ReleaseBuffer(ThreadBuffer *buffer)
+{
+  std::lock_guard<std::mutex> lock(fBuffersMutex);
+  buffer->inUse = false;
+}
+
+void TTrace::SetThreadName(const std::string &name)
+{
+  auto &handle = GetHandle();
+  std::lock_guard<std::mutex> lock(fBuffersMutex);
+  if (handle.buffer != nullptr) {
+    if (handle.buffer->name == name) return;
+    handle.buffer->inUse = false;
+  }
+  handle.buffer = AcquireBuffer(name);
+}
+
+void TTrace::Push(const TraceEvent &event)
+{
+  auto &buffer = GetThreadBuffer();
+  auto head = buffer.head.load(std::memory_order_relaxed);
+  buffer.events[head & (kBufferSize - 1)] = event;
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void TTrace::AddSpan(const char *name, uint64_t start, uint64_t end)
+{
+  Push({name, start, end > start ? end - start : 0, false});
+}
+
+void TTrace::AddInstant(const char *name)
+{
+  Push({name, TPipelineStats::Now(), 0, true});
+}
+
+bool TTrace::Dump(const std::string &fileName)
+{
+  std::ofstream fout(fileName);
+  if (!fout) {
+    std::cerr << "Can not open trace file " << fileName << std::endl;
+    return false;
+  }
+
+  auto nEvents = 0UL;
+  fout << "{\"traceEvents\":[\n";
+  fout << std::fixed << std::setprecision(3);
+  bool first = true;
+  auto separator = [&first, &fout]() {
+    if (!first) fout << ",\n";
+    first = false;
+  };
+
+  std::lock_guard<std::mutex> lock(fBuffersMutex);
+  for (const auto &buffer : fBuffers) {
+    separator();
+    auto name = buffer->name;
+    if (name.empty()) name = "Thread" + std::to_string(buffer->tid);
+    fout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << buffer->tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+
+    auto head = buffer->head.load(std::memory_order_acquire);
+    auto begin = head > kBufferSize ? head - kBufferSize : 0;
+    for (auto i = begin; i < head; i++) {
+      const auto &event = buffer->events[i & (kBufferSize - 1)];
+      auto ts = (event.start - std::min(event.start, fOrigin)) * 1.e-3;  // us
+      separator();
+      fout << "{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":"
+           << buffer->tid << ",\"ts\":" << ts;
+      if (event.instant)
+        fout << ",\"ph\":\"i\",\"s\":\"t\"}";
+      else
+        fout << ",\"ph\":\"X\",\"dur\":" << event.duration * 1.e-3 << "}";
+      nEvents++;
+    }
+  }
+  fout << "\n]}\n";
+  fout.close();
+
+  std::cout << "Trace with " << nEvents << " events written to " << fileName
+            << std::endl;
+  return true;
+}
+
+TTraceScope::TTraceScope(const char *name)
+    : fName(name), fStart(TPipelineStats::Now())
+{
+}
+
+TTraceScope::~TTraceScope()
+{
+  TTrace::GetInstance().AddSpan(fName, fStart, TPipelineStats::Now());
+}
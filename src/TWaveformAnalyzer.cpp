@@ -0,0 +1,130 @@
+#include "TWaveformAnalyzer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "TWaveformDSP.hpp"
+
+TWaveformAnalyzer::TWaveformAnalyzer() {}
+
+TWaveformAnalyzer::~TWaveformAnalyzer() {}
+
+TWaveformAnalyzer::Settings TWaveformAnalyzer::ParseSettings(
+    const nlohmann::json &conf, const Settings &base)
+{
+  auto settings = base;
+  settings.enabled = conf.value("Enabled", settings.enabled);
+  settings.polarity = conf.value("Polarity", settings.polarity);
+  settings.baselineSamples =
+      conf.value("BaselineSamples", settings.baselineSamples);
+  settings.preTrigger = conf.value("PreTrigger", settings.preTrigger);
+  settings.samplingPeriod =
+      conf.value("SamplingPeriod", settings.samplingPeriod);
+  settings.gateOffset = conf.value("GateOffset", settings.gateOffset);
+  settings.longGate = conf.value("LongGate", settings.longGate);
+  settings.shortGate = conf.value("ShortGate", settings.shortGate);
+  settings.useTrapezoid =
+      conf.value("Energy", std::string("Charge")) == "Trapezoid";
+  settings.trapRise = std::max(1U, conf.value("TrapRise", settings.trapRise));
+  settings.trapFlat = conf.value("TrapFlat", settings.trapFlat);
+  settings.decayTau = conf.value("DecayTau", settings.decayTau);
+  settings.energyScale = conf.value("EnergyScale", settings.energyScale);
+  settings.useCRRC = conf.value("Shaping", std::string("None")) == "CRRC";
+  settings.shapingTau = conf.value("ShapingTau", settings.shapingTau);
+  settings.cfdFraction = conf.value("CFDFraction", settings.cfdFraction);
+  settings.cfdDelay = conf.value("CFDDelay", settings.cfdDelay);
+  settings.threshold = conf.value("Threshold", settings.threshold);
+  return settings;
+}
+
+void TWaveformAnalyzer::LoadConf(const nlohmann::json &conf)
+{
+  // "Default" holds the common values, the analysis runs only for the
+  // modules listed in "Modules" (SCOPE firmware).  It overwrites energy,
+  // energyShort and timeStampNs, so DPP modules must not be listed.
+  Settings defaultSettings;
+  if (conf.contains("Default")) {
+    defaultSettings = ParseSettings(conf["Default"], defaultSettings);
+  }
+  fSettings.fill(defaultSettings);
+
+  if (conf.contains("Modules")) {
+    auto enabled = defaultSettings;
+    enabled.enabled = true;
+    for (auto &mod : conf["Modules"].items()) {
+      auto id = std::stoi(mod.key());
+      if (id < 0 || id > 255) continue;
+      fSettings[id] = ParseSettings(mod.value(), enabled);
+    }
+  }
+}
+
+void TWaveformAnalyzer::Process(DAQData_t &data)
+{
+  const auto nEvents = static_cast<int64_t>(data.size());
+
+#pragma omp parallel
+  {
+    std::vector<float> signal;
+    std::vector<float> shaped;
+    std::vector<float> work;
+    std::vector<float> trapezoid;
+
+#pragma omp for schedule(dynamic, 64)
+    for (auto i = 0L; i < nEvents; i++) {
+      auto &event = data[i];
+      const auto &settings = fSettings[event->module];
+      if (!settings.enabled) continue;
+
+      const auto n = static_cast<uint32_t>(
+          std::min(event->waveformSize, event->analogProbe1.size()));
+      if (n <= settings.baselineSamples || n == 0) continue;
+
+      signal.resize(n);
+      work.resize(n);
+      const auto *wf = event->analogProbe1.data();
+      auto baseline = TWaveformDSP::Baseline(wf, settings.baselineSamples);
+      TWaveformDSP::ToFloat(wf, signal.data(), n, baseline,
+                            settings.polarity);
+
+      const float *timing = signal.data();
+      if (settings.useCRRC) {
+        shaped.resize(n);
+        TWaveformDSP::CRRC(signal.data(), shaped.data(), n,
+                           settings.shapingTau);
+        timing = shaped.data();
+      }
+      auto cfd = TWaveformDSP::CFD(timing, work.data(), n, settings.cfdFraction,
+                                   settings.cfdDelay, settings.threshold);
+      auto triggerSample = cfd >= 0.f ? cfd : float(settings.preTrigger);
+
+      auto gateStart =
+          static_cast<int32_t>(std::floor(triggerSample)) + settings.gateOffset;
+      auto chargeLong = TWaveformDSP::Integrate(signal.data(), n, gateStart,
+                                                settings.longGate);
+      auto chargeShort = TWaveformDSP::Integrate(signal.data(), n, gateStart,
+                                                 settings.shortGate);
+
+      auto energy = chargeLong;
+      if (settings.useTrapezoid) {
+        trapezoid.resize(n);
+        TWaveformDSP::Trapezoid(signal.data(), work.data(), trapezoid.data(), n,
+                                settings.trapRise, settings.trapFlat,
+                                settings.decayTau);
+        uint32_t position;
+        energy = TWaveformDSP::Max(trapezoid.data(), n, position);
+      }
+
+      energy *= settings.energyScale;
+      chargeShort *= settings.energyScale;
+      event->energy = static_cast<uint16_t>(std::clamp(energy, 0.f, 65535.f));
+      event->energyShort =
+          static_cast<int16_t>(std::clamp(chargeShort, -32768.f, 32767.f));
+      if (cfd >= 0.f) {
+        event->timeStampNs +=
+            (cfd - settings.preTrigger) * settings.samplingPeriod;
+      }
+    }
+  }
+}
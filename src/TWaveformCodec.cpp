@@ -0,0 +1,123 @@
+#include "TWaveformCodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+inline uint32_t ZigZag(int32_t x)
+{
+  return (static_cast<uint32_t>(x) << 1) ^ static_cast<uint32_t>(x >> 31);
+}
+inline int32_t UnZigZag(uint32_t x)
+{
+  return static_cast<int32_t>(x >> 1) ^ -static_cast<int32_t>(x & 1);
+}
+constexpr std::size_t kHeaderSize = sizeof(uint32_t) + sizeof(int16_t);
+}  // namespace
+
+std::size_t TWaveformCodec::MaxEncodedSize(uint32_t n)
+{
+  // 17 bits are enough for the difference of two int16
+  auto nBlocks = (n + kBlockSize - 1) / kBlockSize;
+  return kHeaderSize + nBlocks * (1 + 17 * sizeof(uint32_t));
+}
+
+uint32_t TWaveformCodec::PackBlock(const uint32_t *values, uint32_t *planes)
+{
+  uint32_t all = 0;
+#pragma omp simd reduction(| : all)
+  for (auto i = 0U; i < kBlockSize; i++) all |= values[i];
+  const uint32_t width = all == 0 ? 0 : 32 - __builtin_clz(all);
+
+  for (auto j = 0U; j < width; j++) {
+    uint32_t plane = 0;
+#pragma omp simd reduction(| : plane)
+    for (auto i = 0U; i < kBlockSize; i++) {
+      plane |= ((values[i] >> j) & 1U) << i;
+    }
+    planes[j] = plane;
+  }
+  return width;
+}
+
+void TWaveformCodec::UnpackBlock(const uint32_t *planes, uint32_t width,
+                                 uint32_t *values)
+{
+#pragma omp simd
+  for (auto i = 0U; i < kBlockSize; i++) values[i] = 0;
+  for (auto j = 0U; j < width; j++) {
+    const auto plane = planes[j];
+#pragma omp simd
+    for (auto i = 0U; i < kBlockSize; i++) {
+      values[i] |= ((plane >> i) & 1U) << j;
+    }
+  }
+}
+
+void TWaveformCodec::Encode(const int16_t *wf, uint32_t n,
+                            std::vector<uint8_t> &out)
+{
+  auto pos = out.size();
+  out.resize(pos + MaxEncodedSize(n));
+  auto *buf = out.data();
+
+  std::memcpy(buf + pos, &n, sizeof(n));
+  pos += sizeof(n);
+  const int16_t first = n > 0 ? wf[0] : 0;
+  std::memcpy(buf + pos, &first, sizeof(first));
+  pos += sizeof(first);
+
+  uint32_t values[kBlockSize];
+  uint32_t planes[32];
+  for (auto start = 1U; start < n; start += kBlockSize) {
+    const auto length = std::min(kBlockSize, n - start);
+#pragma omp simd
+    for (auto i = 0U; i < length; i++) {
+      values[i] = ZigZag(int32_t(wf[start + i]) - int32_t(wf[start + i - 1]));
+    }
+    for (auto i = length; i < kBlockSize; i++) values[i] = 0;
+
+    const auto width = PackBlock(values, planes);
+    buf[pos++] = static_cast<uint8_t>(width);
+    std::memcpy(buf + pos, planes, width * sizeof(uint32_t));
+    pos += width * sizeof(uint32_t);
+  }
+  out.resize(pos);
+}
+
+bool TWaveformCodec::Decode(const uint8_t *in, std::size_t size,
+                            std::vector<int16_t> &wf)
+{
+  if (size < kHeaderSize) return false;
+  uint32_t n;
+  std::memcpy(&n, in, sizeof(n));
+  int16_t first;
+  std::memcpy(&first, in + sizeof(n), sizeof(first));
+  auto pos = kHeaderSize;
+
+  // Each block takes at least its width byte, a larger count is broken
+  if (n > 1 + uint64_t(size - kHeaderSize) * kBlockSize) return false;
+  wf.resize(n);
+  if (n == 0) return true;
+  wf[0] = first;
+
+  uint32_t values[kBlockSize];
+  uint32_t planes[32];
+  for (auto start = 1U; start < n; start += kBlockSize) {
+    if (pos >= size) return false;
+    const uint32_t width = in[pos++];
+    if (width > 32 || pos + width * sizeof(uint32_t) > size) return false;
+    std::memcpy(planes, in + pos, width * sizeof(uint32_t));
+    pos += width * sizeof(uint32_t);
+
+    UnpackBlock(planes, width, values);
+    // Prefix sum is serial, the unpacking above is not
+    const auto length = std::min(kBlockSize, n - start);
+    for (auto i = 0U; i < length; i++) {
+      wf[start + i] =
+          static_cast<int16_t>(wf[start + i - 1] + UnZigZag(values[i]));
+    }
+  }
+  return true;
+}
@@ -0,0 +1,216 @@
+#include "TWaveformDSP.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+DSP_TARGET_CLONES
+float TWaveformDSP::Baseline(const int16_t *wf, uint32_t n)
+{
+  if (n == 0) return 0.f;
+  float sum = 0.f;
+#pragma omp simd reduction(+ : sum)
+  for (auto i = 0U; i < n; i++) sum += wf[i];
+  return sum / n;
+}
+
+DSP_TARGET_CLONES
+void TWaveformDSP::MinMax(const int16_t *wf, uint32_t n, int16_t &min,
+                          int16_t &max)
+{
+  int16_t localMin = INT16_MAX;
+  int16_t localMax = INT16_MIN;
+#pragma omp simd reduction(min : localMin) reduction(max : localMax)
+  for (auto i = 0U; i < n; i++) {
+    localMin = wf[i] < localMin ? wf[i] : localMin;
+    localMax = wf[i] > localMax ? wf[i] : localMax;
+  }
+  min = localMin;
+  max = localMax;
+}
+
+DSP_TARGET_CLONES
+float TWaveformDSP::BaselineRMS(const int16_t *wf, uint32_t n, float baseline)
+{
+  if (n == 0) return 0.f;
+  float sum2 = 0.f;
+#pragma omp simd reduction(+ : sum2)
+  for (auto i = 0U; i < n; i++) {
+    float diff = wf[i] - baseline;
+    sum2 += diff * diff;
+  }
+  return std::sqrt(sum2 / n);
+}
+
+DSP_TARGET_CLONES
+void TWaveformDSP::ToFloat(const int16_t *wf, float *out, uint32_t n,
+                           float baseline, float polarity)
+{
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) out[i] = (wf[i] - baseline) * polarity;
+}
+
+DSP_TARGET_CLONES
+float TWaveformDSP::Max(const float *in, uint32_t n, uint32_t &position)
+{
+  float max = in[0];
+#pragma omp simd reduction(max : max)
+  for (auto i = 0U; i < n; i++) max = in[i] > max ? in[i] : max;
+
+  position = 0;
+  for (auto i = 0U; i < n; i++) {
+    if (in[i] == max) {
+      position = i;
+      break;
+    }
+  }
+  return max;
+}
+
+DSP_TARGET_CLONES
+float TWaveformDSP::Integrate(const float *in, uint32_t n, int32_t start,
+                              uint32_t length)
+{
+  int64_t first = start < 0 ? 0 : start;
+  int64_t last = int64_t(start) + length;
+  if (last > n) last = n;
+  float sum = 0.f;
+#pragma omp simd reduction(+ : sum)
+  for (auto i = first; i < last; i++) sum += in[i];
+  return sum;
+}
+
+DSP_TARGET_CLONES
+void TWaveformDSP::Trapezoid(const float *in, float *work, float *out,
+                             uint32_t n, uint32_t rise, uint32_t flat,
+                             float tau)
+{
+  const uint32_t k = rise;
+  const uint32_t l = rise + flat;
+
+  // d[i] = x[i] - x[i - k] - x[i - l] + x[i - k - l], vectorised
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    float d = in[i];
+    if (i >= k) d -= in[i - k];
+    if (i >= l) d -= in[i - l];
+    if (i >= k + l) d += in[i - k - l];
+    work[i] = d;
+  }
+
+  // Accumulation with pole-zero correction (Jordanov)
+  const float m = tau > 0.f ? 1.f / (std::exp(1.f / tau) - 1.f) : 0.f;
+  const float norm = 1.f / (k * (m + 1.f));
+  float p = 0.f;
+  float s = 0.f;
+  for (auto i = 0U; i < n; i++) {
+    p += work[i];
+    s += p + m * work[i];
+    out[i] = s * norm;
+  }
+}
+
+void TWaveformDSP::CRRC(const float *in, float *out, uint32_t n, float tau)
+{
+  if (n == 0) return;
+  const float a = tau / (tau + 1.f);
+  const float b = 1.f / (tau + 1.f);
+  float cr = 0.f;
+  float rc = 0.f;
+  float prev = in[0];
+  for (auto i = 0U; i < n; i++) {
+    cr = a * (cr + in[i] - prev);
+    prev = in[i];
+    rc += b * (cr - rc);
+    out[i] = rc;
+  }
+}
+
+DSP_TARGET_CLONES
+float TWaveformDSP::CFD(const float *in, float *work, uint32_t n,
+                        float fraction, uint32_t delay, float threshold)
+{
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    work[i] = fraction * in[i] - (i >= delay ? in[i - delay] : 0.f);
+  }
+
+  auto arm = 0U;
+  while (arm < n && in[arm] < threshold) arm++;
+  if (arm == n) return -1.f;
+
+  // Bipolar signal goes from positive to negative on the leading edge.
+  // Armed at the threshold crossing, earlier zero crossings are noise.
+  for (auto i = std::max(arm, 1U); i < n; i++) {
+    if (work[i - 1] > 0.f && work[i] <= 0.f) {
+      return (i - 1) + work[i - 1] / (work[i - 1] - work[i]);
+    }
+  }
+  return -1.f;
+}
+
+DSP_TARGET_CLONES
+uint32_t TWaveformDSP::CountEdges(const float *in, float *work, uint32_t n,
+                                  uint32_t rise, float threshold,
+                                  uint32_t holdOff)
+{
+#pragma omp simd
+  for (auto i = 0U; i < n; i++) {
+    work[i] = i >= rise ? in[i] - in[i - rise] : 0.f;
+  }
+
+  auto nEdges = 0U;
+  for (auto i = 1U; i < n; i++) {
+    if (work[i - 1] < threshold && work[i] >= threshold) {
+      nEdges++;
+      i += holdOff;
+    }
+  }
+  return nEdges;
+}
+
+void TWaveformDSP::FFTTables(uint32_t n, float *cosTable, float *sinTable)
+{
+  for (auto i = 0U; i < n / 2; i++) {
+    cosTable[i] = std::cos(2. * M_PI * i / n);
+    sinTable[i] = -std::sin(2. * M_PI * i / n);
+  }
+}
+
+DSP_TARGET_CLONES
+void TWaveformDSP::FFT(float *re, float *im, uint32_t n, const float *cosTable,
+                       const float *sinTable)
+{
+  // Bit reversal permutation
+  for (auto i = 1U, j = 0U; i < n; i++) {
+    auto bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+
+  // Butterflies, the inner loop runs over independent pairs
+  for (auto half = 1U; half < n; half <<= 1) {
+    const auto step = n / (2 * half);
+    for (auto start = 0U; start < n; start += 2 * half) {
+      auto *reA = re + start;
+      auto *imA = im + start;
+      auto *reB = re + start + half;
+      auto *imB = im + start + half;
+#pragma omp simd
+      for (auto j = 0U; j < half; j++) {
+        const auto wr = cosTable[j * step];
+        const auto wi = sinTable[j * step];
+        const auto tr = reB[j] * wr - imB[j] * wi;
+        const auto ti = reB[j] * wi + imB[j] * wr;
+        reB[j] = reA[j] - tr;
+        imB[j] = imA[j] - ti;
+        reA[j] += tr;
+        imA[j] += ti;
+      }
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#include "TWaveformGate.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+TWaveformGate::TWaveformGate()
+{
+  fPrescale.assign(1, 0);
+  fCounter.assign(1 << 16, 0);
+  fIsReference.assign(1 << 16, 0);
+}
+
+TWaveformGate::~TWaveformGate() {}
+
+void TWaveformGate::LoadConf(const std::string &fileName)
+{
+  std::ifstream fin(fileName);
+  if (!fin) {
+    std::cerr << "Waveform gate configuration " << fileName << " not found"
+              << std::endl;
+    exit(1);
+  }
+  nlohmann::json conf;
+  fin >> conf;
+  fin.close();
+  LoadConf(conf);
+}
+
+void TWaveformGate::LoadConf(const nlohmann::json &conf)
+{
+  // "Prescale": N by channel as in TChannelSettings
+  fPrescale.clear();
+  fCounter.assign(1 << 16, 0);
+  auto prescale = conf.value("Prescale", nlohmann::json::object());
+  fPrescaleIndex.Load(prescale, [this](const nlohmann::json &n) {
+    fPrescale.push_back(n.is_number() ? n.get<uint32_t>() : 0U);
+    return fPrescale.size() - 1;
+  });
+
+  // "Coincidence": {"Window": ns, "References": [[mod, ch], ...]}
+  fIsReference.assign(1 << 16, 0);
+  fCoincidenceWindow = 0.;
+  if (conf.contains("Coincidence")) {
+    auto coinc = conf["Coincidence"];
+    fCoincidenceWindow = coinc.value("Window", 0.);
+    auto refs = coinc.value("References", std::vector<std::vector<uint32_t>>());
+    for (const auto &ref : refs) {
+      if (ref.size() != 2 || ref[0] > 255 || ref[1] > 255) {
+        std::cerr << "Invalid waveform gate reference" << std::endl;
+        continue;
+      }
+      fIsReference[(ref[0] << 8) | ref[1]] = 1;
+    }
+  }
+
+  // "QAFlags": mask of TEventData::qaFlags bits
+  fQAMask = conf.value("QAFlags", uint8_t(0));
+}
+
+bool TWaveformGate::InCoincidence(double time) const
+{
+  for (const auto *refs : {&fRefTimes, &fLastRefTimes}) {
+    auto it = std::lower_bound(refs->begin(), refs->end(),
+                               time - fCoincidenceWindow);
+    if (it != refs->end() && *it <= time + fCoincidenceWindow) return true;
+  }
+  return false;
+}
+
+void TWaveformGate::Evaluate(const DAQData_t &data, std::vector<uint8_t> &keep,
+                             const std::vector<uint8_t> *select)
+{
+  const auto n = data.size();
+  keep.assign(n, 0);
+
+  const bool useCoincidence = fCoincidenceWindow > 0.;
+  if (useCoincidence) {
+    // References of the previous batch cover hits around the boundary
+    std::swap(fRefTimes, fLastRefTimes);
+    fRefTimes.clear();
+    for (const auto &event : data) {
+      if (fIsReference[(event->module << 8) | event->channel])
+        fRefTimes.push_back(event->timeStampNs);
+    }
+    std::sort(fRefTimes.begin(), fRefTimes.end());
+  }
+
+  for (auto i = 0U; i < n; i++) {
+    const auto &event = data[i];
+    if (event->waveformSize == 0 || (select && !(*select)[i])) continue;
+    const auto id = (event->module << 8) | event->channel;
+    const auto prescale = fPrescale[fPrescaleIndex[id]];
+
+    bool pass = false;
+    if (prescale > 0 && ++fCounter[id] >= prescale) {
+      fCounter[id] = 0;
+      pass = true;
+    }
+    if (event->qaFlags & fQAMask) pass = true;
+    if (!pass && useCoincidence) pass = InCoincidence(event->timeStampNs);
+
+    keep[i] = pass;
+    if (pass)
+      fNKept++;
+    else
+      fNDropped++;
+  }
+}
@@ -0,0 +1,92 @@
+#include "TWaveformQA.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "TWaveformDSP.hpp"
+
+TWaveformQA::TWaveformQA() {}
+
+TWaveformQA::~TWaveformQA() {}
+
+TWaveformQA::Settings TWaveformQA::ParseSettings(const nlohmann::json &conf,
+                                                 const Settings &base)
+{
+  auto settings = base;
+  settings.enabled = true;
+  settings.saturationLow = conf.value("SaturationLow", settings.saturationLow);
+  settings.saturationHigh =
+      conf.value("SaturationHigh", settings.saturationHigh);
+  settings.baselineSamples =
+      conf.value("BaselineSamples", settings.baselineSamples);
+  settings.maxBaselineRMS =
+      conf.value("MaxBaselineRMS", settings.maxBaselineRMS);
+  settings.polarity = conf.value("Polarity", settings.polarity);
+  settings.edgeRise = std::max(1U, conf.value("EdgeRise", settings.edgeRise));
+  settings.edgeThreshold = conf.value("EdgeThreshold", settings.edgeThreshold);
+  settings.edgeHoldOff = conf.value("EdgeHoldOff", settings.edgeHoldOff);
+  return settings;
+}
+
+void TWaveformQA::LoadConf(const nlohmann::json &conf)
+{
+  // "Default" applies to all modules, "Modules" overrides by module ID
+  Settings defaultSettings;
+  if (conf.contains("Default")) {
+    defaultSettings = ParseSettings(conf["Default"], defaultSettings);
+  }
+  fSettings.fill(defaultSettings);
+
+  if (conf.contains("Modules")) {
+    for (auto &mod : conf["Modules"].items()) {
+      auto id = std::stoi(mod.key());
+      if (id < 0 || id > 255) continue;
+      fSettings[id] = ParseSettings(mod.value(), defaultSettings);
+    }
+  }
+}
+
+void TWaveformQA::Process(DAQData_t &data)
+{
+  const auto nEvents = static_cast<int64_t>(data.size());
+
+#pragma omp parallel
+  {
+    std::vector<float> signal;
+    std::vector<float> work;
+
+#pragma omp for schedule(dynamic, 64)
+    for (auto i = 0L; i < nEvents; i++) {
+      auto &event = data[i];
+      const auto &settings = fSettings[event->module];
+      if (!settings.enabled) continue;
+
+      const auto n = static_cast<uint32_t>(
+          std::min(event->waveformSize, event->analogProbe1.size()));
+      if (n <= settings.baselineSamples || n == 0) continue;
+
+      const auto *wf = event->analogProbe1.data();
+      uint8_t flags = kQAChecked;
+
+      int16_t min, max;
+      TWaveformDSP::MinMax(wf, n, min, max);
+      if (min <= settings.saturationLow || max >= settings.saturationHigh)
+        flags |= kQASaturation;
+
+      auto baseline = TWaveformDSP::Baseline(wf, settings.baselineSamples);
+      auto rms =
+          TWaveformDSP::BaselineRMS(wf, settings.baselineSamples, baseline);
+      if (rms > settings.maxBaselineRMS) flags |= kQANoisyBaseline;
+
+      signal.resize(n);
+      work.resize(n);
+      TWaveformDSP::ToFloat(wf, signal.data(), n, baseline, settings.polarity);
+      auto nEdges = TWaveformDSP::CountEdges(
+          signal.data(), work.data(), n, settings.edgeRise,
+          settings.edgeThreshold, settings.edgeHoldOff);
+      if (nEdges > 1) flags |= kQAPileUp;
+
+      event->qaFlags = flags;
+    }
+  }
+}